@@ -168,27 +168,39 @@ void printf(const char *fmt, ...)
 
 void test_sleep()
 {
-	sys_fork();
+	int parent = sys_getpid(), child = sys_fork();
 	int pid = sys_getpid();
-	if (pid == 0)
-		sys_sleep(0, Sigset()); // sleep self
+	if (child)
+		sys_sleep(parent, Sigset()); // sleep self
 
 	for (int i = 0; ; i ++)
 	{
 		if (i == 10)
 		{
-			if (pid == 1)
-				sys_wakeup(0);
-			else if (pid == 0)
-				sys_sleep(1, Sigset()); // sleep other
+			if (!child)
+				sys_wakeup(parent);
+			else
+				sys_sleep(child, Sigset()); // sleep other
 		}
-		if (i == 20 && pid == 0)
-			sys_wakeup(1);
+		if (i == 20 && child)
+			sys_wakeup(child);
 		printf("pid %d: %d\n", pid, i);
 		for (int volatile j = 0; j  < 10000000; j ++);
 	}
 }
 
+void test_nanosleep()
+{
+	Timespec_t ts;
+	ts.sec = 0;
+	ts.nsec = 500000000;
+	for (int i = 0; i < 10; i ++)
+	{
+		printf("pid %d: %d\n", sys_getpid(), i);
+		sys_nanosleep(&ts, NULL);
+	}
+}
+
 void test_fork()
 {
 	const int NF = 4096;
@@ -207,16 +219,99 @@ void test_fork()
 		if (f[i])
 			goto error;
 	printf("%d: ok\n", sys_getpid());
-	for (; ;);
+	for (; ;)
+		sys_sleep(sys_getpid(), Sigset());
 
 error:
 	printf("no\n");
-	for (; ;);
+	for (; ;)
+		sys_sleep(sys_getpid(), Sigset());
 }
 
-extern "C" void _start()
+void test_kheap_stat()
 {
+	Kheap_stat_t stat;
+	if (sys_kheap_stat(sys_getpid(), &stat))
+	{
+		printf("sys_kheap_stat failed\n");
+		return;
+	}
+	printf("kernel heap: %u calls to kmalloc, %u to kfree\n", stat.nalloc, stat.nfree);
+	printf("allocated: %u bytes  free: %u bytes in %u blocks (largest %u)\n",
+			stat.nbytes_alloc, stat.nbytes_free, stat.nfree_block, stat.largest_free);
+	printf("this task: %u bytes allocated, %u freed\n",
+			stat.task_nbytes_alloc, stat.task_nbytes_free);
+
+	static Kheap_site_stat_t site[16];
+	int nsite = sys_kheap_site_stat(site, 16);
+	for (int i = 0; i < nsite; i ++)
+		printf("  %p: %u allocations, %u bytes\n", (void*)site[i].caller,
+				site[i].nalloc, site[i].nbytes);
+}
+
+void test_spawn()
+{
+	const char *argv[] = {"initrd", "spawned", NULL};
+	int pid = sys_spawn("initrd", argv), status;
+	printf("spawn returned %d\n", pid);
+	pid = sys_waitpid(pid, &status);
+	printf("waitpid returned %d, exit status %d\n", pid, status);
+}
+
+void test_vfork()
+{
+	const char *argv[] = {"initrd", "vforked", NULL};
+	int status, pid = sys_vfork();
+	if (!pid)
+	{
+		sys_exec("initrd", argv);
+		sys_exit(127);
+	}
+	printf("vfork returned %d\n", pid);
+	pid = sys_waitpid(pid, &status);
+	printf("waitpid returned %d, exit status %d\n", pid, status);
+}
+
+void test_exit()
+{
+	// spawn and reap many short-lived tasks; the kernel heap should not grow
+	const int NLOOP = 1000;
+	const char *argv[] = {"initrd", "spawned", NULL};
+	Kheap_stat_t before, after;
+	for (int i = 0; i < NLOOP; i ++)
+	{
+		// the first task fills the caches of kernel stacks and Task_t objects
+		if (i == 1)
+			sys_kheap_stat(sys_getpid(), &before);
+		int status = -1, pid = sys_spawn("initrd", argv);
+		if (sys_waitpid(-1, &status) != pid || status != 2)
+		{
+			printf("test_exit: wrong waitpid result at %d\n", i);
+			return;
+		}
+	}
+	sys_kheap_stat(sys_getpid(), &after);
+	printf("test_exit: %d tasks reaped, kernel heap allocated: %u -> %u bytes\n",
+			NLOOP, before.nbytes_alloc, after.nbytes_alloc);
+	if (sys_waitpid(-1, NULL) != -1)
+		printf("test_exit: waitpid without children succeeded\n");
+}
+
+extern "C" void _start(int argc, char **argv)
+{
+	if (argc > 1)
+	{
+		printf("%s: spawned with %d arguments, argv[1]=%s\n", argv[0], argc, argv[1]);
+		sys_exit(argc);
+	}
+
 	printf("hello, user mode!\n");
+	// test_spawn();
+	// test_vfork();
+	// test_exit();
+	// test_kheap_stat();
+	// test_nanosleep();
 	test_sleep();
+	sys_exit(0);
 }
 
@@ -1,6 +1,6 @@
 /*
  * $File: syscall.h
- * $Date: Wed Dec 29 19:52:52 2010 +0800
+ * $Date: Sun Oct 18 10:07:11 2026 +0800
  *
  * interface for implementing system calls
  */
@@ -29,6 +29,34 @@ along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
 typedef int pid_t;
 class Sigset;
 
+// see src/include/kheap.h
+struct Kheap_stat_t
+{
+	unsigned int
+		nalloc, nfree,
+		nbytes_alloc,
+		nbytes_free,
+		largest_free,
+		nfree_block,
+		node_high_water,
+		nsite_lost,
+		nwarm_page,
+		nwarm_reuse,
+		task_nbytes_alloc,
+		task_nbytes_free;
+};
+
+struct Kheap_site_stat_t
+{
+	unsigned int caller, nalloc, nbytes;
+};
+
+// see src/include/timer.h
+struct Timespec_t
+{
+	unsigned int sec, nsec;
+};
+
 #define DEFN_SYSCALL0(num, fn, ret_t) \
 static inline ret_t fn() \
 { \
@@ -65,5 +93,30 @@ static inline pid_t sys_sleep(pid_t pid, const Sigset &sig_wakeup)
 }
 
 DEFN_SYSCALL1(4, sys_wakeup, pid_t, pid_t);
+DEFN_SYSCALL2(5, sys_kheap_stat, int, pid_t, Kheap_stat_t *);
+DEFN_SYSCALL2(6, sys_kheap_site_stat, int, Kheap_site_stat_t *, int);
+
+// run the boot module @name in a new task, with NULL-terminated arguments @argv
+DEFN_SYSCALL2(7, sys_spawn, pid_t, const char *, const char * const *);
+
+// nice value of a task, from -20 (highest priority) to 19
+DEFN_SYSCALL2(8, sys_set_nice, int, pid_t, int);
+DEFN_SYSCALL2(9, sys_get_nice, int, pid_t, int *);
+
+// sleep for @req; if woken up earlier, -1 is returned and the time left is stored in @rem
+DEFN_SYSCALL2(10, sys_nanosleep, int, const Timespec_t *, Timespec_t *);
+
+// terminate current task; the exit status is collected by the parent with sys_waitpid
+DEFN_SYSCALL1(11, sys_exit, int, int);
+
+// wait for child @pid (any child if -1) to exit, return its pid and store the exit status in @status
+DEFN_SYSCALL2(12, sys_waitpid, pid_t, pid_t, int *);
+
+// like sys_fork, but the child borrows the address space of the caller, which
+// is suspended until the child calls sys_exec or sys_exit
+DEFN_SYSCALL0(13, sys_vfork, pid_t);
+
+// run the boot module @name in place of current program; return only on error
+DEFN_SYSCALL2(14, sys_exec, int, const char *, const char * const *);
 
 #endif
@@ -1,6 +1,6 @@
 /*
  * $File: descriptor_table.cpp
- * $Date: Tue Dec 21 15:56:31 2010 +0800
+ * $Date: Sun Oct 18 09:19:04 2026 +0800
  *
  * initialize descriptor tables
  *
@@ -70,6 +70,8 @@ struct TSS_entry_t
 	uint16_t reserved, iomap_base;
 } __attribute__((packed));
 
+static TSS_entry_t tss_entry;
+
 
 #define LOOP_ALL_INTERRUPT(func) \
 	func(0); func(1); func(2); func(3); func(4); func(5); func(6); func(7); \
@@ -97,7 +99,6 @@ void init_gdt()
 {
 	static GDT_entry_t	gdt_entries[6];
 	static GDT_ptr_t	gdt_ptr;
-	static TSS_entry_t	tss_entry;
 
 	gdt_ptr.limit = sizeof(gdt_entries) - 1;
 	gdt_ptr.base = (uint32_t)&gdt_entries;
@@ -119,7 +120,7 @@ void init_gdt()
 	// TSS
 	memset(&tss_entry, 0, sizeof(tss_entry));
 	tss_entry.ss0 = KERNEL_DATA_SELECTOR;
-	tss_entry.esp0 = KERNEL_STACK_POS;
+	tss_entry.esp0 = 0; // set by set_kernel_stack() on task switching
 	tss_entry.cs = KERNEL_CODE_SELECTOR | 0x03;
 	tss_entry.ss = tss_entry.ds = tss_entry.es = tss_entry.fs = tss_entry.gs = KERNEL_DATA_SELECTOR | 0x03;
 	gdt_entries[5].set((uint32_t)&tss_entry, ((uint32_t)&tss_entry) + sizeof(TSS_entry_t), 0b11101001, 0);
@@ -128,6 +129,11 @@ void init_gdt()
 	tss_flush();
 }
 
+void set_kernel_stack(uint32_t esp0)
+{
+	tss_entry.esp0 = esp0;
+}
+
 void init_idt()
 {
 	static IDT_entry_t	idt_entries[256];
@@ -1,6 +1,6 @@
 /*
  * $File: kheap.cpp
- * $Date: Wed Dec 29 20:17:41 2010 +0800
+ * $Date: Sun Oct 18 10:10:06 2026 +0800
  *
  * manipulate kernel heap (virtual memory)
  */
@@ -27,6 +27,8 @@ along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
 #include <common.h>
 #include <page.h>
 #include <klog.h>
+#include <slab.h>
+#include <task.h>
 #include <lib/rbtree.h>
 #include <lib/cstring.h>
 
@@ -41,8 +43,53 @@ static uint32_t kheap_static_end = (uint32_t)&kernel_img_end + 4;
 // used for memory allocating before calling kheap_init
 static void* kmalloc_pre_init(uint32_t size, int palign);
 
+// number of allocations served by the tree (i.e. not by slab caches)
+static uint32_t ntree_alloc;
+
+// statistics maintained on every allocation (see kheap_get_stat())
+static Kheap_stat_t stat;
+
+namespace Site_stat
+{
+	// allocations per call site, in an open addressing hash table keyed by
+	// the return address; allocations from sites not fitting in the table are
+	// only counted in nlost
+	static const int NSITE = 128;
+	static Kheap_site_stat_t sites[NSITE];
+	static uint32_t nlost;
+
+	static void account(uint32_t caller, uint32_t nbytes);
+}
+
+namespace Warm
+{
+	// pages released by kfree keep their frames for a while, so reusing them
+	// soon does not fault and allocate again; at most NPAGE_MAX pages are
+	// kept, and the oldest ones are given back to the frame allocator first
+	static const uint32_t NPAGE_MAX = 256;
+
+	// one bit for each page in the kernel heap, set iff it is warm
+	static uint32_t map[(KERNEL_HEAP_END - KERNEL_HEAP_BEGIN) >> 17];
+
+	// FIFO of warm page addresses, which may also hold pages no longer warm
+	static uint32_t ring[NPAGE_MAX], ring_head, ring_size;
+
+	static uint32_t npage, nreuse;
+
+	// clear the bit of page @addr and return whether it was set
+	static inline bool test_clear(uint32_t addr);
+
+	static void add(uint32_t addr);
+
+	// free the frame of the oldest warm page, return false if there is none
+	static bool release_one();
+}
+
 uint32_t USER_MEM_LOW, USER_MEM_HIGH;
 
+// start of the memory managed by the heap (see Page::HEAP_TABLE_AREA_END)
+static const uint32_t HEAP_BEGIN = Page::HEAP_TABLE_AREA_END;
+
 struct Block_t
 {
 	uint32_t start, size;
@@ -53,158 +100,315 @@ struct Block_size_t: public Block_t
 	// unallocated memory block, sort by size
 	inline bool operator < (const Block_size_t &n) const
 	{ return size < n.size || (size == n.size && start < n.start); }
+
+	inline bool operator <= (const Block_size_t &n) const
+	{ return !(n < *this); }
 	
 	Block_size_t(const Block_t &b) : Block_t::Block_t(b) {}
 	Block_size_t() {}
 };
 
-struct Block_start_t: public Block_t
-{
-	// unallocated memory block, sort by start
-	inline bool operator < (const Block_start_t &n) const
-	{ return start < n.start || (start == n.start && size < n.size);}
-	inline bool operator <= (const Block_start_t &n) const
-	{ return start < n.start || (start == n.start && size <= n.size);}
+/*
+ * Every block in the kernel heap (allocated or not) has a boundary tag at
+ * both ends, recording its size and whether it is in use, so the neighbours
+ * of a block can be found by pointer arithmetic.
+ *
+ * Layout of an allocated block:
+ *		tag | padding | start address of the block | user data | tag
+ * Pages of an unallocated block are freed, except the ones holding its tags.
+ */
+typedef uint32_t Tag_t;
+static const uint32_t
+	TAG_USED = 1,
+	BLOCK_ALIGN = 8,	// size of every block is a multiple of BLOCK_ALIGN
+	BLOCK_SIZE_MIN = 16,
+	ALIGN_NPROBE = 4;	// number of blocks to try before taking one that surely fits
 
-	Block_start_t(const Block_t &b) : Block_t::Block_t(b) {}
-	Block_start_t() {}
-};
+static inline Tag_t& tag_at(uint32_t addr)
+{ return *(Tag_t*)addr; }
+
+static inline void set_tags(uint32_t start, uint32_t size, Tag_t used)
+{ tag_at(start) = tag_at(start + size - sizeof(Tag_t)) = size | used; }
 
 namespace Tree_mm
 {
 	// memory manager for rbt
+	// nodes are taken from static_mem first; afterwards, whenever the number
+	// of spare nodes drops below RESERVE, refill() borrows a chunk from the
+	// heap itself, and the reserve covers the nodes needed by that kmalloc
 	static const int
 		STATIC_SIZE = 1024,
 		TREE_NODE_SIZE = sizeof(Rbt<Block_t>::Node),
-		STATIC_MEM_SIZE = STATIC_SIZE * TREE_NODE_SIZE;
+		STATIC_MEM_SIZE = STATIC_SIZE * TREE_NODE_SIZE,
+		RESERVE = 16;
+	// chosen so that a chunk occupies exactly one page in the heap
+	static const uint32_t CHUNK_SIZE = 0x1000 - sizeof(Tag_t) * 3;
 	static uint8_t static_mem[STATIC_MEM_SIZE] __attribute__((aligned(2)));
-	static void* freed[STATIC_SIZE];
-	static int nstatic_mem, nfreed;
+	static void *free_list; // singly linked list of unused nodes
+	static int nstatic_mem,
+			   nspare = STATIC_SIZE,	// number of nodes available without refilling
+			   nused, nused_max, nchunk;
+	static bool refilling;
 
 	static void* alloc();
 	static void free(void *ptr);
+
+	// must be called after the tree operations of kmalloc/kfree are done
+	static void refill();
 }
 
 static Rbt<Block_size_t> tree_size(Tree_mm::alloc, Tree_mm::free);
-static Rbt<Block_start_t> tree_start(Tree_mm::alloc, Tree_mm::free);
+
+static inline void tree_erase_node(Rbt<Block_size_t>::Node *ptr)
+{
+	stat.nbytes_free -= ptr->get_key().size;
+	stat.nfree_block --;
+	tree_size.erase(ptr);
+}
+
+// remove the unallocated block [@start, @start + @size) from the size index
+static inline void tree_erase(uint32_t start, uint32_t size)
+{
+	Block_t blk;
+	blk.start = start;
+	blk.size = size;
+	tree_erase_node(tree_size.find_ge(blk));
+}
+
+// find a best-fit unallocated block for @size bytes aligned on 2^@palign byte boundries,
+// with at most ALIGN_NPROBE + 1 tree lookups
+// return NULL if no such block
+static Rbt<Block_size_t>::Node* find_fit(uint32_t size, int palign);
+
+static inline void tree_insert(uint32_t start, uint32_t size)
+{
+	Block_t blk;
+	blk.start = start;
+	blk.size = size;
+	tree_size.insert(blk);
+	stat.nbytes_free += size;
+	stat.nfree_block ++;
+}
+
+// get the size of the allocated block holding @ptr returned by kheap_alloc_block
+static inline uint32_t get_block_size(void *ptr)
+{ return tag_at(*(uint32_t*)((uint32_t)ptr - sizeof(uint32_t))) & ~TAG_USED; }
+
+// free a block allocated by kheap_alloc_block and return its size
+static uint32_t tree_free(void *addr);
 
 void* kmalloc(uint32_t size, int palign)
+{
+	return kmalloc_at(size, palign, __builtin_return_address(0));
+}
+
+void* kmalloc_at(uint32_t size, int palign, void *caller)
 {
 	if (!kheap_finish_init_called)
 		return kmalloc_pre_init(size, palign);
 
-	Block_t req;
-	req.size = size + sizeof(Block_t);
-	req.start = 0;
-	while (1)
+	void *ret = Slab::alloc(size, palign);
+
+	// the statistics are shared by all tasks
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	uint32_t nbytes;
+	if (ret)
+		nbytes = Slab::get_obj_size(ret);
+	else
 	{
-		Rbt<Block_size_t>::Node *ptr = tree_size.find_ge(req);
-		if (!ptr)
-			panic("kernel runs out of memory");
+		ntree_alloc ++;
+		ret = kheap_alloc_block(size, palign);
+		nbytes = get_block_size(ret);
+	}
 
-		Block_t got(ptr->get_key());
-		uint32_t start = get_aligned(got.start + sizeof(Block_t), palign);
-		if (start + size > got.start + got.size)
-		{
-			req = got;
-			req.start ++;
-			continue;
-		}
+	stat.nalloc ++;
+	stat.nbytes_alloc += nbytes;
+	Site_stat::account((uint32_t)caller, nbytes);
+	Task::account_kmem(nbytes, false);
 
-		tree_size.erase(ptr);
-		tree_start.erase(tree_start.find_ge(got));
+	RESTORE_EFLAGS(old_eflags);
+	return ret;
+}
 
-		if (start + size + sizeof(Block_t) * 2 < got.start + got.size)
-		{
-			Block_t nblk;
-			nblk.start = start + size;
-			nblk.size = got.start + got.size - nblk.start;
+void kfree(void *addr)
+{
+	uint32_t nbytes = Slab::get_obj_size(addr);
+	if (nbytes)
+		Slab::free(addr);
 
-			got.size -= nblk.size;
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
 
-			tree_size.insert(nblk);
-			tree_start.insert(nblk);
-		}
+	if (!nbytes)
+		nbytes = tree_free(addr);
 
-		if (start - got.start > sizeof(Block_t) * 3)
-		{
-			Block_t nblk;
-			nblk.start = got.start;
-			nblk.size = start - got.start - sizeof(Block_t);
+	stat.nfree ++;
+	stat.nbytes_alloc -= nbytes;
+	Task::account_kmem(nbytes, true);
+
+	RESTORE_EFLAGS(old_eflags);
+}
 
-			got.size -= nblk.size;
-			got.start += nblk.size;
+void* kheap_alloc_block(uint32_t size, int palign)
+{
+	kassert(kheap_finish_init_called);
 
-			tree_size.insert(nblk);
-			tree_start.insert(nblk);
-		}
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	Rbt<Block_size_t>::Node *ptr = find_fit(size, palign);
+	if (!ptr)
+		panic("kernel runs out of memory");
+
+	Block_t got(ptr->get_key());
+	uint32_t start = get_aligned(got.start + sizeof(Tag_t) * 2, palign),
+			 end = get_aligned(start + size + sizeof(Tag_t), 3),
+			 got_end = got.start + got.size;
+	kassert(end <= got_end);
 
-		Page::current_page_dir->lazy_alloc_interval(
-				(start - sizeof(Block_t)) & 0xFFFFF000, get_aligned(start + size, 12),
-				false, true, false);
+	tree_erase_node(ptr);
 
-		memcpy((void*)(start - sizeof(Block_t)), &got, sizeof(Block_t));
+	// [blk_start, blk_end) is the block to be allocated
+	uint32_t blk_start = got.start, blk_end = got_end,
+			 map_start = blk_start, map_end = blk_end;
 
-		return (void*)start;
+	if (end + BLOCK_SIZE_MIN <= got_end)
+	{
+		blk_end = end;
+		map_end = end + sizeof(Tag_t);
+	}
+
+	if (((start - sizeof(Tag_t) * 2) & ~(BLOCK_ALIGN - 1)) >= got.start + BLOCK_SIZE_MIN)
+	{
+		blk_start = (start - sizeof(Tag_t) * 2) & ~(BLOCK_ALIGN - 1);
+		map_start = blk_start - sizeof(Tag_t);
 	}
+
+	map_start &= 0xFFFFF000;
+	map_end = get_aligned(map_end, 12);
+	for (uint32_t i = map_start; i < map_end; i += 0x1000)
+		if (Warm::test_clear(i))
+		{
+			Warm::npage --;
+			Warm::nreuse ++;
+		}
+	Page::current_page_dir->lazy_alloc_interval(map_start, map_end, false, true, false);
+
+	if (blk_end != got_end)
+	{
+		set_tags(blk_end, got_end - blk_end, 0);
+		tree_insert(blk_end, got_end - blk_end);
+	}
+
+	if (blk_start != got.start)
+	{
+		set_tags(got.start, blk_start - got.start, 0);
+		tree_insert(got.start, blk_start - got.start);
+	}
+
+	set_tags(blk_start, blk_end - blk_start, TAG_USED);
+	*(uint32_t*)(start - sizeof(uint32_t)) = blk_start;
+
+	Tree_mm::refill();
+
+	RESTORE_EFLAGS(old_eflags);
+	return (void*)start;
 }
 
-void kfree(void *addr)
+void kheap_free_block(void *addr)
 {
-	Block_t blk;
-	memcpy(&blk, (void*)((uint32_t)addr - sizeof(Block_t)), sizeof(Block_t));
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	tree_free(addr);
+
+	RESTORE_EFLAGS(old_eflags);
+}
 
-	if (blk.start < KERNEL_HEAP_BEGIN || blk.start + blk.size > KERNEL_HEAP_END)
+uint32_t tree_free(void *addr)
+{
+	uint32_t start = *(uint32_t*)((uint32_t)addr - sizeof(uint32_t));
+
+	if (start < HEAP_BEGIN || start >= (uint32_t)addr || (start & (BLOCK_ALIGN - 1)) ||
+			!(tag_at(start) & TAG_USED))
 		panic("trting to free invalid memory: addr=%p", addr);
 
-	uint32_t free_start = blk.start,
-			 free_end = blk.start + blk.size;
-	// memory address range to be freed later
+	uint32_t size = tag_at(start) & ~TAG_USED,
+			 end = start + size;
 
-	Rbt<Block_start_t>::Node *ptr = tree_start.find_le(blk);
-	Block_t got;
-	
-	if (ptr)
-	{
-		got = ptr->get_key();
-		if (got.start + got.size > blk.start)
-			panic("trting to free invalid memory: addr=%p", addr);
+	if (end > KERNEL_HEAP_END || end <= (uint32_t)addr ||
+			tag_at(end - sizeof(Tag_t)) != tag_at(start))
+		panic("trting to free invalid memory: addr=%p", addr);
 
-		if (got.start + got.size == blk.start)
+	if (start > HEAP_BEGIN)
+	{
+		Tag_t prev = tag_at(start - sizeof(Tag_t));
+		if (!(prev & TAG_USED))
 		{
-			free_start = max(free_start & 0xFFFFF000, got.start);
+			start -= prev;
+			tree_erase(start, prev);
+		}
+	}
 
-			tree_start.erase(ptr);
-			tree_size.erase(tree_size.find_ge(got));
-			blk.start = got.start;
-			blk.size += got.size;
+	if (end < KERNEL_HEAP_END)
+	{
+		Tag_t next = tag_at(end);
+		if (!(next & TAG_USED))
+		{
+			tree_erase(end, next);
+			end += next;
 		}
 	}
-	
 
-	ptr = tree_start.find_ge(blk);
+	set_tags(start, end - start, 0);
+	tree_insert(start, end - start);
 
-	if (ptr)
+	// keep used pages warm, except the ones holding the tags which are never freed
+	for (uint32_t i = get_aligned(start + sizeof(Tag_t), 12);
+			i < ((end - sizeof(Tag_t)) & 0xFFFFF000); i += 0x1000)
 	{
-		got = ptr->get_key();
-		if (blk.start + blk.size > got.start)
-			panic("trting to free invalid memory: addr=%p", addr);
+		Page::Table_entry_t *page = Page::current_page_dir->get_page(i);
+		if (page && page->present)
+			Warm::add(i);
+	}
 
-		if (blk.start + blk.size == got.start)
-		{
-			free_end = min(get_aligned(free_end, 12), blk.start + blk.size);
+	Tree_mm::refill();
 
-			tree_start.erase(ptr);
-			tree_size.erase(tree_size.find_ge(got));
-			blk.size += got.size;
-		}
-	}
+	return size;
+}
 
-	tree_start.insert(blk);
-	tree_size.insert(blk);
+Rbt<Block_size_t>::Node* find_fit(uint32_t size, int palign)
+{
+	Block_t req;
+	req.size = sizeof(Tag_t) * 2 + get_aligned(size + sizeof(Tag_t), 3);
+	req.start = 0;
+
+	// the alignment padding never exceeds 2^@palign - BLOCK_ALIGN,
+	// so a block of size_fit bytes can always hold the request
+	uint32_t size_fit = req.size;
+	if (palign > 3)
+		size_fit += (1 << palign) - BLOCK_ALIGN;
 
-	// free used pages
-	Page::current_page_dir->free_interval(get_aligned(free_start, 12), free_end & 0xFFFFF000);
+	for (uint32_t i = 0; i < ALIGN_NPROBE && req.size < size_fit; i ++)
+	{
+		Rbt<Block_size_t>::Node *ptr = tree_size.find_ge(req);
+		if (!ptr)
+			return NULL;
+
+		const Block_t &got = ptr->get_key();
+		uint32_t start = get_aligned(got.start + sizeof(Tag_t) * 2, palign);
+		if (get_aligned(start + size + sizeof(Tag_t), 3) <= got.start + got.size)
+			return ptr;
+
+		req = got;
+		req.start ++;
+	}
+
+	req.size = size_fit;
+	req.start = 0;
+	return tree_size.find_ge(req);
 }
 
 uint32_t kheap_get_size_pre_init()
@@ -231,40 +435,182 @@ void kheap_init()
 	for(uint32_t *ptr = &kheap_start_ctors; ptr < &start_ctors; ptr ++)
 		((void (*)(void))*ptr)();
 
-	Block_t b;
-	b.start = KERNEL_HEAP_BEGIN;
-	b.size = KERNEL_HEAP_END - KERNEL_HEAP_BEGIN;
-	tree_size.insert(b);
-	tree_start.insert(b);
+	tree_insert(HEAP_BEGIN, KERNEL_HEAP_END - HEAP_BEGIN);
 
-	for (uint32_t i = KERNEL_HEAP_BEGIN; i < KERNEL_HEAP_END; i += 0x1000)
-		Page::current_page_dir->get_page(i, true);
+	// other heap tables are created on demand
+	Page::current_page_dir->get_page(KERNEL_HEAP_BEGIN, true);
 }
 
 void kheap_finish_init()
 {
+	// page fault handler is not ready yet, so allocate the pages holding the tags now
+	Page::current_page_dir->alloc_interval(HEAP_BEGIN, HEAP_BEGIN + 0x1000, false, true);
+	Page::current_page_dir->alloc_interval(KERNEL_HEAP_END - 0x1000, KERNEL_HEAP_END, false, true);
+	set_tags(HEAP_BEGIN, KERNEL_HEAP_END - HEAP_BEGIN, 0);
+
 	kheap_finish_init_called = true;
 	USER_MEM_LOW = get_aligned(kheap_static_end, 22);
-	USER_MEM_HIGH = KERNEL_HEAP_BEGIN - 1;
+	USER_MEM_HIGH = PHYSMAP_BEGIN - 1;
 	Klog::log(Klog::INFO, "kernel heap address range: %p %p", (void*)KERNEL_HEAP_BEGIN, (void*)KERNEL_HEAP_END);
 }
 
+uint32_t kheap_reclaim(uint32_t npage)
+{
+	uint32_t ret = 0;
+	while (ret < npage && Warm::release_one())
+		ret ++;
+	return ret;
+}
+
+bool Warm::test_clear(uint32_t addr)
+{
+	uint32_t idx = (addr - KERNEL_HEAP_BEGIN) >> 12,
+			 mask = 1u << (idx & 31);
+	if (!(map[idx >> 5] & mask))
+		return false;
+	map[idx >> 5] &= ~mask;
+	return true;
+}
+
+void Warm::add(uint32_t addr)
+{
+	uint32_t idx = (addr - KERNEL_HEAP_BEGIN) >> 12;
+	if ((map[idx >> 5] >> (idx & 31)) & 1)
+		return;
+
+	if (ring_size == NPAGE_MAX)
+		release_one();
+
+	ring[(ring_head + ring_size) % NPAGE_MAX] = addr;
+	ring_size ++;
+	map[idx >> 5] |= 1u << (idx & 31);
+	npage ++;
+}
+
+bool Warm::release_one()
+{
+	while (ring_size)
+	{
+		uint32_t addr = ring[ring_head];
+		ring_head = (ring_head + 1) % NPAGE_MAX;
+		ring_size --;
+		if (test_clear(addr))
+		{
+			npage --;
+			Page::current_page_dir->free_interval(addr, addr + 0x1000);
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t kheap_get_node_high_water()
+{
+	return Tree_mm::nused_max;
+}
+
+void kheap_get_stat(Kheap_stat_t &ret)
+{
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	ret = stat;
+	ret.node_high_water = Tree_mm::nused_max;
+	ret.nsite_lost = Site_stat::nlost;
+	ret.nwarm_page = Warm::npage;
+	ret.nwarm_reuse = Warm::nreuse;
+
+	Block_t blk;
+	blk.start = blk.size = 0xFFFFFFFF;
+	Rbt<Block_size_t>::Node *ptr = tree_size.find_le(blk);
+	ret.largest_free = ptr ? ptr->get_key().size : 0;
+
+	RESTORE_EFLAGS(old_eflags);
+}
+
+int kheap_get_site_stat(Kheap_site_stat_t *buf, int nbuf)
+{
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	int n = 0;
+	for (int i = 0; i < Site_stat::NSITE && n < nbuf; i ++)
+		if (Site_stat::sites[i].caller)
+			buf[n ++] = Site_stat::sites[i];
+
+	RESTORE_EFLAGS(old_eflags);
+	return n;
+}
+
+void Site_stat::account(uint32_t caller, uint32_t nbytes)
+{
+	uint32_t h = (caller >> 2) % NSITE;
+	for (int i = 0; i < NSITE; i ++)
+	{
+		Kheap_site_stat_t &site = sites[h];
+		if (site.caller == caller || !site.caller)
+		{
+			site.caller = caller;
+			site.nalloc ++;
+			site.nbytes += nbytes;
+			return;
+		}
+		if ((++ h) == NSITE)
+			h = 0;
+	}
+	nlost ++;
+}
+
 void* Tree_mm::alloc()
 {
-	if (nfreed)
-		return freed[-- nfreed];
+	void *ret;
+	if (free_list)
+	{
+		ret = free_list;
+		free_list = *static_cast<void**>(ret);
+	}
+	else
+	{
+		if (nstatic_mem + TREE_NODE_SIZE > STATIC_MEM_SIZE)
+			panic("run out of kernel heap");
 
-	if (nstatic_mem + TREE_NODE_SIZE >= STATIC_MEM_SIZE)
-		panic("run out of kernel heap");
+		ret = static_mem + nstatic_mem;
+		nstatic_mem += TREE_NODE_SIZE;
+	}
 
-	void *ret = static_mem + nstatic_mem;
-	nstatic_mem += TREE_NODE_SIZE;
+	nspare --;
+	if ((++ nused) > nused_max)
+		nused_max = nused;
 	return ret;
 }
 
 void Tree_mm::free(void *ptr)
 {
-	freed[nfreed ++] = ptr;
+	*static_cast<void**>(ptr) = free_list;
+	free_list = ptr;
+	nspare ++;
+	nused --;
+}
+
+void Tree_mm::refill()
+{
+	if (refilling || nspare >= RESERVE)
+		return;
+
+	// the allocation below may call refill() again
+	refilling = true;
+	while (nspare < RESERVE)
+	{
+		uint8_t *chunk = static_cast<uint8_t*>(kheap_alloc_block(CHUNK_SIZE, 0));
+		for (uint32_t i = 0; i + TREE_NODE_SIZE <= CHUNK_SIZE; i += TREE_NODE_SIZE)
+		{
+			*reinterpret_cast<void**>(chunk + i) = free_list;
+			free_list = chunk + i;
+			nspare ++;
+		}
+		nchunk ++;
+	}
+	refilling = false;
 }
 
 #ifdef _DEBUG_BUILD_
@@ -281,13 +627,17 @@ void kheap_output_debug_msg()
 	push_color(LIGHT_GREEN, BLACK);
 	puts("start kernel heap debug output\n");
 
-	printf("number of nodes ever allocated: %d\n", Tree_mm::nstatic_mem / Tree_mm::TREE_NODE_SIZE);
-	printf("number of currently ununsed nodes: %d\n", Tree_mm::nfreed);
+	printf("number of nodes in use: %d (max %d)\n", Tree_mm::nused, Tree_mm::nused_max);
+	printf("number of spare nodes: %d\n", Tree_mm::nspare);
+	printf("number of chunks borrowed from the heap: %d\n", Tree_mm::nchunk);
+	printf("number of allocations served by the tree: %d\n", ntree_alloc);
+	printf("bytes allocated: %d  bytes free: %d in %d blocks\n",
+			stat.nbytes_alloc, stat.nbytes_free, stat.nfree_block);
+	printf("warm pages: %d (reused %d times)\n", Warm::npage, Warm::nreuse);
+	Slab::output_debug_msg();
 
 	puts("unallocated blocks sorted by size:\n");
 	tree_size.walk(walk_block<Block_size_t>);
-	puts("unallocated blocks sorted by start:\n");
-	tree_start.walk(walk_block<Block_start_t>);
 
 	puts("end kernel heap debug output\n");
 	pop_color();
@@ -1,6 +1,6 @@
 /*
  * $File: main.cpp
- * $Date: Wed Dec 29 17:39:54 2010 +0800
+ * $Date: Sun Oct 18 10:10:40 2026 +0800
  *
  * This file contains the main routine of JKOS kernel
  */
@@ -30,24 +30,25 @@ along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
 #include <page.h>
 #include <common.h>
 #include <kheap.h>
+#include <slab.h>
 #include <task.h>
+#include <timer.h>
 #include <elf.h>
 #include <drv/ramdisk.h>
 #include <lib/cxxsupport.h>
 #include <lib/cstring.h>
 
-static void init_timer();
-static void timer_tick(Isr_registers_t reg);
 static void isr_kbd(Isr_registers_t reg);
 
 static int volatile last_key;
+static Task::Wait_queue_t kbd_wait; // tasks waiting for a key
 
 static void wait_key()
 {
 	Klog::printf("press any key to continue...\n");
 	for (int volatile i = 0; i < 10000000; i ++);
 	last_key = 0;
-	while (!last_key);
+	wait_event(kbd_wait, last_key);
 }
 
 void test_alloc()
@@ -101,15 +102,241 @@ void test_alloc()
 	delete []ptr;
 }
 
-void test_fork(Multiboot_info_t *mbd)
+void test_kmalloc_align()
 {
-	pid_t fork_ret = Task::fork();
-	Klog::printf("fork returned %d\n", fork_ret);
+	// fill the heap with holes which are large enough for a page table but
+	// can not hold one on a page boundary, and measure the cost of
+	// allocating page tables as in fork
+	const int NHOLE_MAX = 512, NLOOP = 64;
+	static void *hole[NHOLE_MAX], *sep[NHOLE_MAX];
+	for (int nhole = 0; nhole <= NHOLE_MAX; nhole = nhole ? nhole * 2 : 16)
+	{
+		for (int i = 0; i < nhole; i ++)
+		{
+			sep[i] = kmalloc(sizeof(Page::Table_t) + 16, 12);
+			hole[i] = kmalloc(sizeof(Page::Table_t) + 100);
+		}
+		for (int i = 0; i < nhole; i ++)
+			kfree(hole[i]);
+
+		uint64_t start = read_tsc();
+		for (int i = 0; i < NLOOP; i ++)
+			kfree(kmalloc(sizeof(Page::Table_t), 12));
+		uint32_t cycles = (uint32_t)(read_tsc() - start);
+
+		Klog::printf("holes: %d  cycles per page table allocation: %d\n",
+				nhole, cycles / NLOOP);
+
+		for (int i = 0; i < nhole; i ++)
+			kfree(sep[i]);
+	}
+}
+
+static void kmalloc_stress_worker(void *)
+{
+	const int NOBJ_SHIFT = 6, NOBJ = 1 << NOBJ_SHIFT, NLOOP_SHIFT = 11;
+	pid_t pid = Task::getpid();
+	uint32_t seed = pid + 1;
+	void *obj[NOBJ];
+
+	uint64_t start = read_tsc();
+	for (int l = 0; l < (1 << NLOOP_SHIFT); l ++)
+	{
+		for (int i = 0; i < NOBJ; i ++)
+		{
+			seed = seed * 1103515245 + 12345;
+			obj[i] = kmalloc(sizeof(pid_t) + (seed >> 16) % (Slab::OBJ_SIZE_MAX - sizeof(pid_t) + 1));
+			*static_cast<pid_t*>(obj[i]) = pid;
+		}
+		for (int i = 0; i < NOBJ; i ++)
+		{
+			if (*static_cast<pid_t*>(obj[i]) != pid)
+				panic("pid %d: object %p corrupted", pid, obj[i]);
+			kfree(obj[i]);
+		}
+	}
+	uint32_t cycles = (uint32_t)((read_tsc() - start) >> (NLOOP_SHIFT + NOBJ_SHIFT));
+
+	Klog::printf("(pid %d) cycles per kmalloc/kfree pair: %d\n", pid, cycles);
+}
+
+void test_kmalloc_stress()
+{
+	// NTASK tasks, standing for NTASK CPUs, allocate and free small objects
+	// at the same time and get preempted by the timer in the middle; the
+	// sizes never exceed Slab::OBJ_SIZE_MAX, so only the slab caches are used
+	const int NTASK = 4;
+	for (int i = 1; i < NTASK; i ++)
+		Task::kernel_thread(kmalloc_stress_worker, NULL);
+	kmalloc_stress_worker(NULL);
+
+	int status;
+	while (Task::waitpid((pid_t)-1, status) != (pid_t)-1);
+}
+
+void test_pge()
+{
+	// cost of reloading CR3 (as in a task switch) and then touching kernel
+	// heap pages, with and without global kernel pages
+	if (!(cpuid_features() & CPUID_PGE))
+	{
+		Klog::printf("global pages not supported\n");
+		return;
+	}
+
+	const int NPAGE = 64, NLOOP_SHIFT = 8;
+	uint8_t *buf = static_cast<uint8_t*>(kmalloc(NPAGE << 12, 12));
+	memset(buf, 0, NPAGE << 12);
+
+	uint32_t cr4;
+	asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+	for (int pge = 1; pge >= 0; pge --)
+	{
+		uint32_t val = pge ? cr4 | 0x80 : cr4 & ~0x80;
+		asm volatile ("mov %0, %%cr4" : : "r"(val));
+
+		uint64_t start = read_tsc();
+		for (int l = 0; l < (1 << NLOOP_SHIFT); l ++)
+		{
+			asm volatile
+			(
+				"mov %%cr3, %%eax\n"
+				"mov %%eax, %%cr3"
+				: : : "eax"
+			);
+			for (int i = 0; i < NPAGE; i ++)
+				*(volatile uint8_t*)(buf + (i << 12));
+		}
+		uint32_t cycles = (uint32_t)((read_tsc() - start) >> NLOOP_SHIFT);
+
+		Klog::printf("global pages %s: cycles per CR3 reload and %d page accesses: %d\n",
+				pge ? "on" : "off", NPAGE, cycles);
+	}
+	asm volatile ("mov %0, %%cr4" : : "r"(cr4));
+
+	kfree(buf);
+}
+
+static void do_nothing(void *)
+{
+}
+
+void test_fork_latency()
+{
+	// cost of creating a task in a copy of the address space against its
+	// resident size (1mb to 256mb, as long as enough frames are free), and of
+	// the exit and reaping of the task, which exits at once
+	const uint32_t BASE = 0x40000000, NFRAME_RESERVED = 1024;
+	uint32_t size = 0;
+	for (int shift = 20; shift <= 28; shift += 2)
+	{
+		uint32_t nframe = ((1u << shift) - size) >> 12;
+		if (Page::get_nfree_frames() < nframe + NFRAME_RESERVED)
+			break;
+		Page::current_page_dir->alloc_interval(BASE + size, BASE + (1 << shift), true, true);
+		size = 1 << shift;
+
+		uint64_t start = read_tsc();
+		pid_t pid = Task::kernel_thread(do_nothing, NULL);
+		uint32_t cycles = (uint32_t)(read_tsc() - start);
+
+		int status;
+		start = read_tsc();
+		Task::waitpid(pid, status);
+		uint32_t exit_cycles = (uint32_t)(read_tsc() - start);
+
+		Klog::printf("kernel_thread with %d mb resident: %d cycles, exit and reap: %d cycles\n",
+				size >> 20, cycles, exit_cycles);
+	}
+	Page::current_page_dir->free_interval(BASE, BASE + size);
+}
+
+static void switch_partner(void *parent)
+{
+	uint32_t old_eflags;
+	for (; ;)
+	{
+		CLI_SAVE_EFLAGS(old_eflags);
+		Task::wakeup((pid_t)parent);
+		Task::sleep(Task::getpid(), Sigset());
+		RESTORE_EFLAGS(old_eflags);
+	}
+}
+
+void test_switch()
+{
+	// two tasks waking each other up and going to sleep: the cost of a
+	// sleep/wakeup round through the scheduler, per context switch
+	const int NLOOP_SHIFT = 14;
+	pid_t parent = Task::getpid(),
+		  child = Task::kernel_thread(switch_partner, (void*)parent);
+	uint32_t old_eflags;
+
+	uint32_t tick_start = Timer::get_ticks();
+	uint64_t start = read_tsc();
+	for (int i = 0; i < (1 << NLOOP_SHIFT); i ++)
+	{
+		CLI_SAVE_EFLAGS(old_eflags);
+		Task::wakeup(child);
+		Task::sleep(parent, Sigset());
+		RESTORE_EFLAGS(old_eflags);
+	}
+	uint32_t cycles = (uint32_t)((read_tsc() - start) >> (NLOOP_SHIFT + 1)),
+			 nticks = Timer::get_ticks() - tick_start;
+
+	Klog::printf("cycles per context switch: %d\n", cycles);
+	if (nticks)
+		Klog::printf("context switches per second: %d\n",
+				(uint32_t)((2u << NLOOP_SHIFT) * KERNEL_HZ / nticks));
+	Task::sleep(child, Sigset());
+}
+
+static const int hog_nice[] = {0, 0, 5, 10};
+static volatile uint32_t hog_count[4], hog_stop;
+
+static void nice_hog(void *idx)
+{
+	int i = (int)idx;
+	Task::set_nice(Task::getpid(), hog_nice[i]);
+	while (Timer::get_ticks() < hog_stop)
+		hog_count[i] ++;
+}
+
+void test_nice()
+{
+	// CPU hogs with different nice values counting for the same time
+	// fairness: the share of each should follow its weight, which is
+	// 1024, 1024, 335 and 110 for nice 0, 0, 5 and 10 under the fair scheduler
+	// throughput: the total count, compared between the schedulers
+	// (boot with and without "sched=fair")
+	const int NTASK = 4;
+	const uint32_t NTICK = KERNEL_HZ * 4;
+
+	hog_stop = Timer::get_ticks() + NTICK;
+	for (int i = 1; i < NTASK; i ++)
+		Task::kernel_thread(nice_hog, (void*)i);
+	nice_hog((void*)0);
+
+	int status;
+	while (Task::waitpid((pid_t)-1, status) != (pid_t)-1);
+
+	uint32_t total = 0;
+	for (int i = 0; i < NTASK; i ++)
+		total += hog_count[i];
+	Klog::printf("scheduler %s: %d loops in %d ticks\n", Task::get_sched_name(), total, NTICK);
+	for (int i = 0; i < NTASK; i ++)
+		Klog::printf("  nice %d: %d loops, %d/1000\n", hog_nice[i], hog_count[i],
+				hog_count[i] / max(total / 1000, 1u));
+}
+
+static void ramdisk_access(void *arg)
+{
+	Multiboot_info_t *mbd = static_cast<Multiboot_info_t*>(arg);
 	pid_t pid = Task::getpid();
 
 	for (int i = 0; i < 5; i ++)
 	{
-		Klog::printf("fork returned: %d   pid: %d\n", fork_ret, pid);
+		Klog::printf("pid: %d\n", pid);
 		for (int volatile j = 0; j < 1000000; j ++);
 	}
 
@@ -134,32 +361,54 @@ void test_fork(Multiboot_info_t *mbd)
 	}
 
 	Klog::printf("(pid %d) done\n", pid);
-	for (; ;);
 }
 
-void test_sleep()
+void test_fork(Multiboot_info_t *mbd)
+{
+	// two tasks in copies of the same address space, reading and writing
+	// the ramdisk one after another
+	pid_t child = Task::kernel_thread(ramdisk_access, mbd);
+	Klog::printf("kernel_thread returned %d\n", child);
+	ramdisk_access(mbd);
+
+	int status;
+	Task::waitpid(child, status);
+}
+
+static void sleep_loop(pid_t parent, pid_t child)
 {
-	Task::fork();
 	pid_t pid = Task::getpid();
-	if (pid == 0)
-		Task::sleep(0, Sigset()); // sleep self
+	if (pid == parent)
+		Task::sleep(parent, Sigset()); // sleep self
 
 	for (int i = 0; ; i ++)
 	{
 		if (i == 10)
 		{
-			if (pid == 1)
-				Task::wakeup(0);
-			else if (pid == 0)
-				Task::sleep(1, Sigset()); // sleep other
+			if (pid == child)
+				Task::wakeup(parent);
+			else
+				Task::sleep(child, Sigset()); // sleep other
 		}
-		if (i == 20 && pid == 0)
-			Task::wakeup(1);
+		if (i == 20 && pid == parent)
+			Task::wakeup(child);
 		Klog::printf("pid %d: %d\n", pid, i);
 		for (int volatile j = 0; j  < 10000000; j ++);
 	}
 }
 
+static void sleep_child(void *parent)
+{
+	sleep_loop((pid_t)parent, Task::getpid());
+}
+
+void test_sleep()
+{
+	pid_t parent = Task::getpid(),
+		  child = Task::kernel_thread(sleep_child, (void*)parent);
+	sleep_loop(parent, child);
+}
+
 void test_elf(Multiboot_info_t *mbd)
 {
 	kassert(mbd->mods_count);
@@ -170,7 +419,92 @@ void test_elf(Multiboot_info_t *mbd)
 
 	Page::current_page_dir->get_page(stack, true)->alloc(true, true);
 
-	Task::switch_to_user_mode(entry, stack + 0x1000 - 4);
+	// a zero return address, argc and argv
+	memset((void*)(stack + 0x1000 - 12), 0, 12);
+	Task::switch_to_user_mode(entry, stack + 0x1000 - 12);
+}
+
+static void test_timer_callback(void *arg)
+{
+	(*static_cast<uint32_t*>(arg)) ++;
+}
+
+void test_timer()
+{
+	// a periodic timer firing every 5 ticks, while sleeping for a second
+	// a few times; both should match the tick count
+	static uint32_t nfired;
+	Timer::Timer_t timer;
+	Timer::setup(timer, test_timer_callback, &nfired);
+	timer.period = 5;
+	Timer::add(timer, Timer::get_ticks() + timer.period);
+
+	for (int i = 0; i < 3; i ++)
+	{
+		uint32_t start = Timer::get_ticks(),
+				 left = Task::sleep_timeout(KERNEL_HZ, Sigset());
+		Klog::printf("slept %d ticks (%d left), periodic timer fired %d times\n",
+				Timer::get_ticks() - start, left, nfired);
+	}
+	Timer::cancel(timer);
+}
+
+static Task::Wait_queue_t test_wq;
+static volatile int test_nitem, test_nconsumed, test_nwait;
+static volatile bool test_stop;
+
+static void consumer(void *)
+{
+	// the last term of the condition counts the times a consumer blocks;
+	// every block but the first one of each consumer follows a wakeup
+	uint32_t eflags;
+	CLI_SAVE_EFLAGS(eflags);
+	for (; ;)
+	{
+		wait_event_exclusive(test_wq, test_nitem || test_stop || (test_nwait ++, false));
+		if (!test_nitem)
+			break;
+		test_nitem --;
+		test_nconsumed ++;
+	}
+	RESTORE_EFLAGS(eflags);
+}
+
+void test_wait_queue()
+{
+	// consumers wait exclusively for items produced one at a time, so every
+	// item should wake up only one of them (no thundering herd)
+	const int NTASK = 4, NITEM = 16;
+	uint32_t eflags;
+	pid_t pid[NTASK];
+	for (int i = 0; i < NTASK; i ++)
+		pid[i] = Task::kernel_thread(consumer, NULL);
+	while (test_nwait < NTASK)
+		Task::sleep_timeout(1, Sigset());
+
+	for (int i = 0; i < NITEM; i ++)
+	{
+		CLI_SAVE_EFLAGS(eflags);
+		test_nitem ++;
+		Task::wake_up_one(test_wq);
+		RESTORE_EFLAGS(eflags);
+		Task::sleep_timeout(1, Sigset());
+	}
+
+	// every woken consumer has blocked again after taking its item
+	int nwakeup = test_nwait - NTASK;
+	Klog::printf("%d items consumed, %d wakeups of %d consumers\n", test_nconsumed, nwakeup, NTASK);
+	kassert(test_nconsumed == NITEM && nwakeup == NITEM);
+
+	CLI_SAVE_EFLAGS(eflags);
+	test_stop = true;
+	Task::wake_up_all(test_wq);
+	RESTORE_EFLAGS(eflags);
+	for (int i = 0; i < NTASK; i ++)
+	{
+		int status;
+		Task::waitpid(pid[i], status);
+	}
 }
 
 void test_lazy_alloc()
@@ -206,6 +540,14 @@ void test_lazy_alloc()
 		if (*ptr)
 			panic("%p: %d: not zero!\n", ptr, *ptr);
 	}
+	uint32_t zero_phy = Page::current_page_dir->get_physical_addr((void*)addr);
+	Klog::printf("writing to zero-fill page (frame %p)...\n", (void*)zero_phy);
+	*(uint32_t*)addr = 1;
+	if (Page::current_page_dir->get_physical_addr((void*)addr) == zero_phy)
+		panic("zero frame written");
+	uint32_t nfree, nhit, nmiss;
+	Page::get_zeroed_pool_stat(nfree, nhit, nmiss);
+	Klog::printf("zero-filled pool: free=%d hit=%d miss=%d\n", nfree, nhit, nmiss);
 	panic("done");
 }
 
@@ -222,9 +564,10 @@ extern "C" void kmain(Multiboot_info_t *mbd, uint32_t magic)
 
 	Page::init(mbd);
 	cxxsupport_init();
-	Task::init();
+	Task::init(mbd->flags & MULTIBOOT_INFO_CMDLINE ? (const char*)mbd->cmdline : "");
+	ramdisk_init(mbd);
 
-	init_timer();
+	Timer::init();
 	isr_register(ISR_GET_NUM_BY_IRQ(1), isr_kbd);
 
 	asm volatile ("sti");
@@ -237,6 +580,14 @@ extern "C" void kmain(Multiboot_info_t *mbd, uint32_t magic)
 	*/
 
 	// test_alloc();
+	// test_kmalloc_align();
+	// test_kmalloc_stress();
+	// test_pge();
+	// test_fork_latency();
+	// test_switch();
+	// test_nice();
+	// test_timer();
+	// test_wait_queue();
 	// test_fork(mbd);
 	// test_sleep();
 	// test_lazy_alloc();
@@ -245,29 +596,6 @@ extern "C" void kmain(Multiboot_info_t *mbd, uint32_t magic)
 	cxxsupport_finalize();
 }
 
-void init_timer()
-{
-	isr_register(ISR_GET_NUM_BY_IRQ(0), timer_tick);
-
-	using namespace Port;
-	uint32_t divisor = CLOCK_TICK_RATE / KERNEL_HZ;
-	outb(0x43, 0b00110110);
-	wait();
-	outb(0x40, (uint8_t)(divisor & 0xFF));
-	wait();
-	outb(0x40, (uint8_t)((divisor >> 8) & 0xFF));
-}
-
-void timer_tick(Isr_registers_t reg)
-{
-	static int tick;
-	// if (tick % 100 == 0)
-	//	Klog::printf("timer tick %d\n", tick);
-	tick ++;
-	isr_eoi(reg.int_no);
-	Task::schedule();
-}
-
 void isr_kbd(Isr_registers_t reg)
 {
 	last_key = 0;
@@ -278,5 +606,6 @@ void isr_kbd(Isr_registers_t reg)
 	last_key = code;
 
 	isr_eoi(reg.int_no);
+	Task::wake_up_all(kbd_wait);
 }
 
@@ -1,6 +1,6 @@
 /*
  * $File: page.cpp
- * $Date: Wed Dec 29 19:22:36 2010 +0800
+ * $Date: Sun Oct 18 10:12:04 2026 +0800
  *
  * x86 virtual memory management by paging
  */
@@ -40,35 +40,157 @@ using namespace Page;
 
 Directory_t *Page::current_page_dir;
 
-// stack of usable frames
-static uint32_t *frames, nframes,
-				*frame_ref_cnt, // frame reference count
-				empty_page0_addr, empty_page1_addr, // empty page, used for page copying and zero filling
-				kernel_low_ntable;  // number of tables used by lower kernel code/data
+/*
+ * Physical frames are managed by a buddy allocator: a free block of 2^k frames
+ * starts at a frame number divisible by 2^k, and is kept in the doubly linked
+ * list free_list[k], linked through its first frame. Frame 0 is never managed,
+ * so it is used as the list terminator.
+ */
+static const uint32_t FRAME_NIL = 0;
+
+struct Frame_t
+{
+	// metadata of a physical frame
+
+	uint32_t next	: 20;	// next free block in the free list
+	uint32_t order	: 4;	// order of the free block starting at this frame
+	uint32_t flags	: 8;
+	union
+	{
+		uint32_t prev;		// previous free block in the free list (free frames)
+		struct
+		{
+			// allocated frames
+			uint16_t ref_cnt;	// reference count
+			uint16_t nshare;	// number of other directories sharing the page table in this frame
+		};
+	};
+
+	enum
+	{
+		FREE = 1	// this frame starts a free block
+	};
+} __attribute__((packed));
+
+static Frame_t *frames; // metadata of all the frames, indexed by frame number
+static uint32_t free_list[MAX_ORDER + 1],
+				nframes, // number of free frames
+				nframe_total; // number of frames in @frames
+
+static uint32_t empty_page0_addr, empty_page1_addr, // empty page, used for page copying and zero filling
+													// of frames outside the physmap
+				kernel_low_ntable,  // number of tables used by lower kernel code/data
+				physmap_end;		// physical addresses below this are mapped at PHYSMAP_BEGIN
 static Table_entry_t *empty_page0_ptr, *empty_page1_ptr;
 
+// number of frames to take back from the kernel heap when running out of frames
+static const uint32_t RECLAIM_BATCH = 16;
+
+// a kernel heap table is replaced by a 4mb page only if this many frames
+// would still be free afterwards
+static const uint32_t LARGE_HEAP_MIN_FREE = 4096;
+
+// whether 4mb pages are enabled
+static bool pse_enabled;
+
+// frame number of the frame filled with zero, which is mapped read-only by
+// zero-fill pages until they are written to; its reference count is not maintained
+static uint32_t zero_frame;
+
+static inline bool maps_zero_frame(const Table_entry_t &page)
+{ return page.addr && page.addr == zero_frame; }
+
+/*
+ * Frames already filled with zero, refilled by the idle task so that
+ * zero-fill page faults only need to map a frame. They are allocated from
+ * the buddy allocator (with reference count 1) and only tracked here.
+ */
+static const uint32_t
+	ZEROED_POOL_SIZE = 64,
+	ZEROED_POOL_MIN_FREE = 256; // stop refilling if fewer frames are free
+static uint32_t zeroed_pool[ZEROED_POOL_SIZE], // physical addresses
+				nzeroed, zeroed_nhit, zeroed_nmiss;
+
+// allocate a frame and return its physical address; it is filled with zero if @zero is true
+static uint32_t alloc_page_frame(bool zero);
+
+// fill the frame at physical address @phyaddr with @val
+static void fill_frame(uint32_t phyaddr, uint32_t val);
+
 // this will be false until Page::init() finished
 static bool init_finished;
 
+// shared page tables of the kernel heap and the directory entries pointing to them
+static Table_t *heap_tables[HEAP_NTABLE];
+static Directory_entry_t heap_entries[HEAP_NTABLE];
+
+static uint32_t nheap_table; // number of heap tables (or 4mb pages) created
+
+// create the @idx'th page table of kernel heap
+static void make_heap_table(uint32_t idx);
+
+// map the kernel heap chunks (of 4mb) which lie entirely in [@begin, @end)
+// and are not mapped yet by 4mb pages, if PSE is enabled; so a large page is
+// only used for a block that fills it, since memory freed in it is never
+// given back to the frame allocator
+static void make_heap_large(uint32_t begin, uint32_t end);
+
+// make @entry map a global 4mb page at physical address @phyaddr,
+// which is only accessible by the kernel
+static void set_large_page(Directory_entry_t &entry, uint32_t phyaddr);
+
+// whether the address is mapped in the same way by all page directories,
+// so its page can be global (kept in TLB when CR3 is reloaded)
+static inline bool is_global_addr(uint32_t addr)
+{
+	return addr < (kernel_low_ntable << 22) ||
+		(addr >= PHYSMAP_BEGIN && addr < KERNEL_HEAP_END);
+}
+
+// map the available memory in the physmap (using 4mb pages if possible);
+// must be called after the kernel heap is initialized, which provides the tables
+static void init_physmap(Multiboot_info_t *mbd);
+
+// get the physmap address of physical address @phyaddr, or 0 if it is not in the physmap
+static inline uint32_t physmap_addr(uint32_t phyaddr)
+{ return phyaddr < physmap_end ? PHYSMAP_BEGIN + phyaddr : 0; }
+
+// keep the boot modules out of the frame allocator, and copy the module
+// list, the memory map and the command lines, which may be anywhere, into
+// static memory
+static void preserve_boot_info(Multiboot_info_t *mbd);
+
+// allocate frame metadata
 static void init_frames(Multiboot_info_t *mbd);
 
+// give the available frames not used by kernel static memory to the buddy allocator
+static void init_free_frames(Multiboot_info_t *mbd);
+
+static void free_list_insert(uint32_t frame, uint32_t order);
+static void free_list_remove(uint32_t frame);
+
 static Table_t *clone_table(Table_t *src, uint32_t base_addr);
 
+// give @dir its own copy of its @idx'th table, which is shared copy-on-write
+static void unshare_table(Directory_t *dir, uint32_t idx);
+
 // copy a frame (4kb) from physical address @src to physical address @dest
 static void copy_page_physical(uint32_t dest, uint32_t src);
 
 static void page_fault(Isr_registers_t reg); // page fault handler
 
-void Table_entry_t::alloc(bool user_, bool writable)
+void Table_entry_t::alloc(bool user_, bool writable, bool fill_zero)
 {
 	this->rw = writable ? 1 : 0;
 	this->user = user_ ? 1 : 0;
+	if (maps_zero_frame(*this))
+	{
+		this->addr = 0;
+		fill_zero = true;
+	}
 	if (!this->addr)
 	{
-		if (!nframes)
-			panic("no free frame");
-		this->addr = frames[-- nframes];
-		frame_ref_cnt[this->addr] = 1;
+		this->addr = alloc_page_frame(fill_zero) >> 12;
 		this->allocable = 1;
 		this->present = 1;
 
@@ -76,10 +198,54 @@ void Table_entry_t::alloc(bool user_, bool writable)
 	}
 }
 
+uint32_t alloc_page_frame(bool zero)
+{
+	uint32_t phyaddr = 0;
+	if (zero)
+	{
+		uint32_t old_eflags;
+		CLI_SAVE_EFLAGS(old_eflags);
+		if (nzeroed)
+		{
+			phyaddr = zeroed_pool[-- nzeroed];
+			zeroed_nhit ++;
+		}
+		else
+			zeroed_nmiss ++;
+		RESTORE_EFLAGS(old_eflags);
+		if (phyaddr)
+			return phyaddr;
+	}
+
+	phyaddr = alloc_frames(0);
+	if (!phyaddr && kheap_reclaim(RECLAIM_BATCH))
+		phyaddr = alloc_frames(0);
+	if (!phyaddr)
+	{
+		// last resort: frames in the zero-filled pool
+		uint32_t old_eflags;
+		CLI_SAVE_EFLAGS(old_eflags);
+		if (nzeroed)
+			phyaddr = zeroed_pool[-- nzeroed];
+		RESTORE_EFLAGS(old_eflags);
+		if (!phyaddr)
+			panic("no free frame");
+		return phyaddr;
+	}
+	if (zero)
+		fill_frame(phyaddr, 0);
+	return phyaddr;
+}
+
 void Table_entry_t::lazy_alloc(bool user_, bool writable, bool fill_zero)
 {
 	this->rw = writable ? 1 : 0;
 	this->user = user_ ? 1 : 0;
+	if (maps_zero_frame(*this))
+	{
+		this->addr = 0;
+		this->present = 0;
+	}
 	if (!this->addr)
 	{
 		this->allocable = 1;
@@ -91,13 +257,22 @@ void Table_entry_t::lazy_alloc(bool user_, bool writable, bool fill_zero)
 
 void Table_entry_t::fill_uint32(uint32_t val)
 {
-	empty_page0_ptr->addr = this->addr;
-	invlpg(empty_page0_addr);
+	fill_frame(this->addr << 12, val);
+}
+
+void fill_frame(uint32_t phyaddr, uint32_t val)
+{
+	uint32_t addr = physmap_addr(phyaddr);
+	if (!addr)
+	{
+		empty_page0_ptr->addr = phyaddr >> 12;
+		invlpg(addr = empty_page0_addr);
+	}
 	asm volatile
 	(
 		"cld\n"
 		"rep stosl"
-		: : "a"(val), "c"(1024), "D"(empty_page0_addr)
+		: : "a"(val), "c"(1024), "D"(addr)
 	);
 }
 
@@ -105,9 +280,9 @@ void Table_entry_t::free()
 {
 	if (this->addr)
 	{
-		if (!(-- frame_ref_cnt[this->addr]))
+		if (!maps_zero_frame(*this) && !(-- frames[this->addr].ref_cnt))
 		{
-			frames[nframes ++] = this->addr;
+			free_frames(this->addr << 12, 0);
 			Klog::log(Klog::DEBUG, "frame 0x%x freed", this->addr);
 		}
 		this->addr = 0;
@@ -121,6 +296,23 @@ Table_entry_t* Directory_t::get_page(uint32_t addr, bool make)
 	addr >>= 12;
 	int tb_idx = addr >> 10,
 		tb_offset = addr & 0x3FF;
+	if (entries[tb_idx].shared)
+		unshare_table(this, tb_idx);
+	if (!entries[tb_idx].present && (uint32_t)tb_idx >= (KERNEL_HEAP_BEGIN >> 22) &&
+			(uint32_t)tb_idx < (KERNEL_HEAP_END >> 22))
+	{
+		uint32_t idx = tb_idx - (KERNEL_HEAP_BEGIN >> 22);
+		if (!heap_entries[idx].present)
+		{
+			if (!make)
+				return NULL;
+			make_heap_table(idx);
+		}
+		tables[tb_idx] = heap_tables[idx];
+		entries[tb_idx] = heap_entries[idx];
+	}
+	if (entries[tb_idx].large)
+		return NULL;
 	if (!tables[tb_idx])
 	{
 		if (!make)
@@ -143,6 +335,16 @@ Table_entry_t* Directory_t::get_page(uint32_t addr, bool make)
 
 void Directory_t::enable()
 {
+	if (nheap_linked != nheap_table)
+	{
+		for (uint32_t i = 0; i < HEAP_NTABLE; i ++)
+			if (heap_entries[i].present)
+			{
+				tables[(KERNEL_HEAP_BEGIN >> 22) + i] = heap_tables[i];
+				entries[(KERNEL_HEAP_BEGIN >> 22) + i] = heap_entries[i];
+			}
+		nheap_linked = nheap_table;
+	}
 	current_page_dir = this;
 	asm volatile ("mov %0, %%cr3" : : "r"(phyaddr));
 }
@@ -155,17 +357,89 @@ uint32_t Directory_t::get_physical_addr(void *addr0, bool alloc, bool user, bool
 
 	Table_entry_t *page = get_page(addr);
 	if (page == NULL)
+	{
+		const Directory_entry_t &entry = entries[addr >> 22];
+		if (entry.present && entry.large)
+			return (entry.addr << 12) | (addr & 0x3FFFFF);
 		return 0;
-	if (!page->addr)
+	}
+	// the shared zero frame must not be written through the returned address
+	if (!page->addr || (alloc && maps_zero_frame(*page)))
 	{
 		if (!alloc)
 			return 0;
 		page->alloc(user, writable);
+		invlpg(addr);
 	}
 	return (page->addr << 12) | (addr & 0xFFF);
 }
 
-Directory_t *Page::clone_directory(const Directory_t *src)
+void make_heap_table(uint32_t idx)
+{
+	Table_t *table;
+	uint32_t phyaddr;
+	if (!idx)
+	{
+		// the first table maps the area holding the others,
+		// so it is allocated in static memory before paging is enabled
+		kassert(!init_finished);
+		table = static_cast<Table_t*>(kmalloc(sizeof(Table_t), 12));
+		phyaddr = (uint32_t)table;
+	}
+	else
+	{
+		uint32_t addr = KERNEL_HEAP_BEGIN + ((idx - 1) << 12);
+		Table_entry_t &page = heap_tables[0]->pages[(addr >> 12) & 0x3FF];
+		page.alloc(false, true);
+		page.global = 1;
+		invlpg(addr);
+		table = (Table_t*)addr;
+		phyaddr = page.addr << 12;
+	}
+	memset(table, 0, sizeof(Table_t));
+
+	heap_tables[idx] = table;
+	heap_entries[idx].present = 1;
+	heap_entries[idx].rw = 1;
+	heap_entries[idx].user = 1;
+	heap_entries[idx].addr = phyaddr >> 12;
+	nheap_table ++;
+}
+
+void make_heap_large(uint32_t begin, uint32_t end)
+{
+	if (!pse_enabled || end <= KERNEL_HEAP_BEGIN || begin >= KERNEL_HEAP_END)
+		return;
+
+	// the first chunk holds the heap tables, and the last one only the page
+	// holding the heap end tag
+	uint32_t first = max((max(begin, (uint32_t)KERNEL_HEAP_BEGIN) - KERNEL_HEAP_BEGIN + 0x3FFFFF) >> 22, 1u),
+			 last = min((min(end, (uint32_t)KERNEL_HEAP_END) - KERNEL_HEAP_BEGIN) >> 22,
+					 HEAP_NTABLE - 1);
+	for (uint32_t idx = first; idx < last; idx ++)
+	{
+		if (heap_entries[idx].present || nframes < LARGE_HEAP_MIN_FREE + (1 << MAX_ORDER))
+			continue;
+		uint32_t frame = alloc_frames(MAX_ORDER);
+		if (!frame)
+			return;
+		set_large_page(heap_entries[idx], frame);
+		nheap_table ++;
+	}
+}
+
+void set_large_page(Directory_entry_t &entry, uint32_t phyaddr)
+{
+	kassert(!(phyaddr & 0x3FFFFF));
+	memset(&entry, 0, sizeof(entry));
+	entry.present = 1;
+	entry.rw = 1;
+	entry.large = 1;
+	entry.global = 1;
+	entry.addr = phyaddr >> 12;
+}
+
+Directory_t *Page::new_directory()
 {
 	Directory_t *dest = static_cast<Directory_t*>(kmalloc(sizeof(Directory_t), 12));
 	memset(dest, 0, sizeof(Directory_t));
@@ -175,37 +449,86 @@ Directory_t *Page::clone_directory(const Directory_t *src)
 	// we link kernel tables
 	for (uint32_t i = 0; i < kernel_low_ntable; i ++)
 	{
-		dest->tables[i] = src->tables[i];
-		dest->entries[i] = src->entries[i];
+		dest->tables[i] = current_page_dir->tables[i];
+		dest->entries[i] = current_page_dir->entries[i];
 	}
-	for (uint32_t i = KERNEL_HEAP_BEGIN >> 22; i < (KERNEL_HEAP_END >> 22); i ++)
+	for (uint32_t i = PHYSMAP_BEGIN >> 22; i < (KERNEL_HEAP_END >> 22); i ++)
 	{
-		dest->tables[i] = src->tables[i];
-		dest->entries[i] = src->entries[i];
+		dest->tables[i] = current_page_dir->tables[i];
+		dest->entries[i] = current_page_dir->entries[i];
 	}
 
-	// we should copy kernel stack directly instead of using copy-on-write
-	// or you will see triple fault
-	for (uint32_t i = KERNEL_STACK_POS - KERNEL_STACK_SIZE; i < KERNEL_STACK_POS; i += 0x1000)
-	{
-		dest->get_page(i, true);
-		copy_page_physical(dest->get_physical_addr((void*)i, true, false, true),
-				current_page_dir->get_physical_addr((void*)i));
-	}
+	return dest;
+}
 
+Directory_t *Page::clone_directory(Directory_t *src)
+{
+	Directory_t *dest = new_directory();
 
-	// for other tables, use copy-on-write
-	for (uint32_t i = kernel_low_ntable; i < (KERNEL_HEAP_BEGIN >> 22); i ++)
+	// other tables are shared copy-on-write, and copied on the first write
+	// (or any other modification) by unshare_table
+	bool shared = false;
+	for (uint32_t i = kernel_low_ntable; i < (PHYSMAP_BEGIN >> 22); i ++)
 		if (src->tables[i])
 		{
-			dest->tables[i] = clone_table(src->tables[i], i << 22);
+			if (!(++ frames[src->entries[i].addr].nshare))
+				panic("table share count overflow");
+			src->entries[i].rw = 0;
+			src->entries[i].shared = 1;
+			dest->tables[i] = src->tables[i];
 			dest->entries[i] = src->entries[i];
-			dest->entries[i].addr = current_page_dir->get_physical_addr(dest->tables[i]) >> 12;
+			shared = true;
 		}
 
+	if (shared && src == current_page_dir)
+		src->enable(); // reload CR3 to flush the TLB
+
 	return dest;
 }
 
+void Page::free_directory(Directory_t *dir)
+{
+	kassert(dir != current_page_dir);
+	for (uint32_t i = kernel_low_ntable; i < (PHYSMAP_BEGIN >> 22); i ++)
+	{
+		Table_t *table = dir->tables[i];
+		if (!table)
+			continue;
+		Frame_t &frame = frames[dir->entries[i].addr];
+		if (dir->entries[i].shared && frame.nshare)
+			frame.nshare --;
+		else
+		{
+			for (int j = 0; j < 1024; j ++)
+				table->pages[j].free();
+			kfree(table);
+		}
+		dir->tables[i] = NULL;
+		memset(&dir->entries[i], 0, sizeof(Directory_entry_t));
+	}
+
+	// the boot directory is allocated before the kernel heap is initialized
+	if ((uint32_t)dir >= KERNEL_HEAP_BEGIN)
+		kfree(dir);
+}
+
+void unshare_table(Directory_t *dir, uint32_t idx)
+{
+	Directory_entry_t &entry = dir->entries[idx];
+	Frame_t &frame = frames[entry.addr];
+	if (frame.nshare)
+	{
+		// the other directories keep the old table, whose pages become copy-on-write
+		frame.nshare --;
+		dir->tables[idx] = clone_table(dir->tables[idx], idx << 22);
+		entry.addr = current_page_dir->get_physical_addr(dir->tables[idx]) >> 12;
+	}
+	entry.rw = 1;
+	entry.shared = 0;
+	if (dir == current_page_dir)
+		dir->enable(); // reload CR3 to flush the TLB
+}
+
 Table_t *clone_table(Table_t *src, uint32_t base_addr)
 {
 	Table_t *dest = static_cast<Table_t*>(kmalloc(sizeof(Table_t), 12));
@@ -215,7 +538,11 @@ Table_t *clone_table(Table_t *src, uint32_t base_addr)
 		{
 			src->pages[i].rw = 0;
 			dest->pages[i] = src->pages[i];
-			frame_ref_cnt[src->pages[i].addr] ++;
+			if (maps_zero_frame(src->pages[i]))
+				continue;
+			Frame_t &frame = frames[src->pages[i].addr];
+			if (!(++ frame.ref_cnt))
+				panic("frame reference count overflow");
 			invlpg(base_addr | (i << 12));
 		}
 		else dest->pages[i] = src->pages[i];
@@ -226,9 +553,14 @@ void Directory_t::lazy_alloc_interval(uint32_t begin, uint32_t end, bool user, b
 {
 	kassert((begin & 0xFFFFF000) == begin);
 	kassert((end & 0xFFFFF000) == end);
+	make_heap_large(begin, end);
 	for (uint32_t i = begin; i < end; i += 0x1000)
 	{
-		this->get_page(i, true)->lazy_alloc(user, writable, fill_zero);
+		Table_entry_t *page = this->get_page(i, true);
+		if (!page)
+			continue; // mapped by a 4mb page
+		page->lazy_alloc(user, writable, fill_zero);
+		page->global = is_global_addr(i);
 		invlpg(i);
 	}
 }
@@ -252,9 +584,14 @@ void Directory_t::alloc_interval(uint32_t begin, uint32_t end, bool user, bool w
 {
 	kassert((begin & 0xFFFFF000) == begin);
 	kassert((end & 0xFFFFF000) == end);
+	make_heap_large(begin, end);
 	for (uint32_t i = begin; i < end; i += 0x1000)
 	{
-		this->get_page(i, true)->alloc(user, writable);
+		Table_entry_t *page = this->get_page(i, true);
+		if (!page)
+			continue; // mapped by a 4mb page
+		page->alloc(user, writable);
+		page->global = is_global_addr(i);
 		invlpg(i);
 	}
 }
@@ -264,8 +601,7 @@ void Page::init(void *ptr_mbd)
 	Multiboot_info_t *mbd = static_cast<Multiboot_info_t*>(ptr_mbd);
 	kassert(mbd->flags & MULTIBOOT_INFO_MEM_MAP);
 
-	if (mbd->mods_count)
-		kheap_preserve_mem((*(uint32_t*)(mbd->mods_addr + 4)) + 4);
+	preserve_boot_info(mbd);
 
 	memset(
 			current_page_dir = static_cast<Directory_t*>(kmalloc(sizeof(Directory_t), 12)),
@@ -275,27 +611,60 @@ void Page::init(void *ptr_mbd)
 
 	kheap_init();
 
-	frame_ref_cnt = new uint32_t[frames[0] - frames[nframes - 1] + 1];
-	frame_ref_cnt -= frames[nframes - 1];
+	uint32_t features = cpuid_features();
+	pse_enabled = features & CPUID_PSE;
 
 	// make sure virtual address and physical address of kernel code/data are the same
+	// with PSE, every 4mb except the first (whose page 0 must stay unmapped)
+	// is mapped by a large page; the tail above the last 4mb boundary is
+	// mapped by 4kb pages, since the frames after the static end are given
+	// to the frame allocator and must not be aliased by the kernel
+	uint32_t nlarge = 0;
 	for (uint32_t i = 0x1000; i < kheap_get_size_pre_init(); i += 0x1000)
 	{
+		if (pse_enabled && i >= 0x400000 && !(i & 0x3FFFFF) &&
+				i + 0x400000 <= kheap_get_size_pre_init())
+		{
+			kassert(!current_page_dir->entries[i >> 22].present);
+			set_large_page(current_page_dir->entries[i >> 22], i);
+			nlarge ++;
+			i += 0x3FF000;
+			continue;
+		}
 		Table_entry_t *page = current_page_dir->get_page(i, true);
 		page->present = 1;
 		page->rw = 1;
 		page->user = 0;
+		page->global = 1;
 		page->addr = i >> 12;
 	}
 	kernel_low_ntable = ((kheap_get_size_pre_init() - 1) >> 22) + 1;
-	
-	while (frames[nframes - 1] <= (kheap_get_size_pre_init() >> 12))
-		nframes --;
+
+	init_free_frames(mbd);
+
+	// paging is not enabled yet, so the frame can be accessed directly
+	zero_frame = alloc_frames(0);
+	kassert(zero_frame);
+	memset((void*)zero_frame, 0, 0x1000);
+	zero_frame >>= 12;
 
 	current_page_dir->phyaddr = (uint32_t)(current_page_dir->entries);
 
 	current_page_dir->enable();
 
+	if (pse_enabled)
+	{
+		// must be set before paging is enabled, since large pages are already in use
+		asm volatile
+		(
+			"mov %%cr4, %%eax\n"
+			"or $0x10, %%eax\n" // PSE in CR4
+			"mov %%eax, %%cr4"
+			: : : "eax"
+		);
+		Klog::log(Klog::INFO, "4mb pages enabled, %d used by kernel code/data", nlarge);
+	}
+
 	asm volatile
 	(
 		"mov %%cr0, %%eax\n"
@@ -303,6 +672,18 @@ void Page::init(void *ptr_mbd)
 		"mov %%eax, %%cr0"
 		: : : "eax"
 	);
+	if (features & CPUID_PGE)
+	{
+		asm volatile
+		(
+			"mov %%cr4, %%eax\n"
+			"or $0x80, %%eax\n" // PGE in CR4
+			"mov %%eax, %%cr4"
+			: : : "eax"
+		);
+		Klog::log(Klog::INFO, "global pages enabled");
+	}
+
 	init_finished = true;
 	kheap_finish_init();
 
@@ -318,8 +699,11 @@ void Page::init(void *ptr_mbd)
 	empty_page0_ptr->present = 1;
 	empty_page1_ptr->present = 1;
 
-	Klog::log(Klog::INFO, "page initialization completed.\n kernel static memory usage: %d kb\n available 4k frames: %d (%d mb)",
-			(kheap_get_size_pre_init() - 0x100000) >> 10, nframes, nframes * 4 / 1024);
+	init_physmap(mbd);
+
+	Klog::log(Klog::INFO, "page initialization completed.\n kernel static memory usage: %d kb\n available 4k frames: %d (%d mb)\n physmap: %d mb at %p",
+			(kheap_get_size_pre_init() - 0x100000) >> 10, nframes, nframes * 4 / 1024,
+			physmap_end >> 20, (void*)PHYSMAP_BEGIN);
 }
 
 void page_fault(Isr_registers_t reg)
@@ -328,6 +712,10 @@ void page_fault(Isr_registers_t reg)
 	asm volatile("mov %%cr2, %0" : "=r" (addr));
 
 	Table_entry_t *page = current_page_dir->get_page(addr);
+	if (!(reg.err_code & 1) && (page ? page->present :
+				current_page_dir->entries[addr >> 22].present))
+		return; // a kernel heap table or 4mb page has just been linked into this directory
+
 	if (page && page->allocable)
 	{
 		if (!page->user && reg.eip >= (uint32_t)&kernel_code_end)
@@ -337,28 +725,44 @@ void page_fault(Isr_registers_t reg)
 		{
 			// non-present:
 			// lazy alloc
-			page->alloc(page->user, page->rw);
-			if (page->alloc_fill)
-				page->fill_uint32(0);
+			if (page->alloc_fill && !(reg.err_code & 2))
+			{
+				// read from a zero-fill page: map the shared zero frame,
+				// a frame is allocated when it is written to
+				page->zero_rw = page->rw;
+				page->rw = 0;
+				page->addr = zero_frame;
+				page->present = 1;
+				return;
+			}
+			page->alloc(page->user, page->rw, page->alloc_fill);
 			return;
 		}
 		if (reg.err_code & 2)
 		{
 			// protection violation and write:
+			if (maps_zero_frame(*page))
+			{
+				if (!page->zero_rw)
+					goto error;
+				page->alloc(page->user, true);
+				return;
+			}
+
 			// copy-on-write, only used in user mode
 			if (page->user)
 			{
-				if (!page->addr || !frame_ref_cnt[page->addr])
+				if (!page->addr || !frames[page->addr].ref_cnt)
 				{
 					Klog::printf("frame reference count error\n");
 					goto error;
 				}
-				if (frame_ref_cnt[page->addr] == 1)
+				if (frames[page->addr].ref_cnt == 1)
 					page->rw = 1;
 				else
 				{
 					addr = page->addr;
-					frame_ref_cnt[addr] --;
+					frames[addr].ref_cnt --;
 					page->addr = 0;
 					page->alloc(true, true);
 					copy_page_physical(page->addr << 12, addr << 12);
@@ -405,6 +809,45 @@ error:
 	panic("page fault");
 }
 
+void preserve_boot_info(Multiboot_info_t *mbd)
+{
+	if (!(mbd->flags & MULTIBOOT_INFO_MODS))
+		mbd->mods_count = 0;
+
+	Multiboot_mod_list *mods = (Multiboot_mod_list*)mbd->mods_addr;
+	for (uint32_t i = 0; i < mbd->mods_count; i ++)
+		kheap_preserve_mem(mods[i].mod_end + 4);
+
+	if (mbd->mods_count)
+	{
+		Multiboot_mod_list *copy = static_cast<Multiboot_mod_list*>(
+				kmalloc(sizeof(Multiboot_mod_list) * mbd->mods_count));
+		memcpy(copy, mods, sizeof(Multiboot_mod_list) * mbd->mods_count);
+		mbd->mods_addr = (uint32_t)copy;
+		for (uint32_t i = 0; i < mbd->mods_count; i ++)
+			if (copy[i].cmdline)
+			{
+				const char *src = (const char*)copy[i].cmdline;
+				char *dest = static_cast<char*>(kmalloc(strlen(src) + 1));
+				strcpy(dest, src);
+				copy[i].cmdline = (uint32_t)dest;
+			}
+	}
+
+	// the memory map is read again by init_physmap() after paging is enabled
+	void *mmap = kmalloc(mbd->mmap_length);
+	memcpy(mmap, (void*)mbd->mmap_addr, mbd->mmap_length);
+	mbd->mmap_addr = (uint32_t)mmap;
+
+	if ((mbd->flags & MULTIBOOT_INFO_CMDLINE) && mbd->cmdline)
+	{
+		const char *src = (const char*)mbd->cmdline;
+		char *dest = static_cast<char*>(kmalloc(strlen(src) + 1));
+		strcpy(dest, src);
+		mbd->cmdline = (uint32_t)dest;
+	}
+}
+
 void init_frames(Multiboot_info_t *mbd)
 {
 	uint32_t memsize = 0;
@@ -433,41 +876,208 @@ void init_frames(Multiboot_info_t *mbd)
 		mmap_addr += mmap->size + 4;
 	}
 
-	frames = new uint32_t[memsize >> 12];
-	nframes = 0;
+	nframe_total = memsize >> 12;
+	frames = new Frame_t[nframe_total];
+	memset(frames, 0, sizeof(Frame_t) * nframe_total);
+
+	Klog::log(Klog::INFO, "frame metadata: %d frames, %d bytes each, %d kb in total",
+			nframe_total, sizeof(Frame_t), (sizeof(Frame_t) * nframe_total) >> 10);
+}
+
+void init_free_frames(Multiboot_info_t *mbd)
+{
+	uint32_t first = (kheap_get_size_pre_init() >> 12) + 1;
 
-	mmap_addr = mbd->mmap_addr;
+	uint32_t mmap_addr = mbd->mmap_addr;
 	while (mmap_addr < mbd->mmap_addr + mbd->mmap_length)
 	{
 		Multiboot_mmap_entry_t *mmap = (Multiboot_mmap_entry_t*)mmap_addr;
 		if (mmap->type == MULTIBOOT_MEMORY_AVAILABLE)
 		{
-			uint32_t start = (uint32_t)mmap->addr;
-			if (start)
-				start = ((start - 1) >> 12) + 1;
-			uint32_t end = (uint32_t)(mmap->addr + mmap->len);
-			end >>= 12;
-
-			for (uint32_t i = end - 1; (-- i) >= start; )
-				if (i > (kheap_get_size_pre_init() >> 12))
-					frames[nframes ++] = i;
-				else break;
+			uint32_t start = get_aligned((uint32_t)mmap->addr, 12) >> 12,
+					 end = (uint32_t)(mmap->addr + mmap->len) >> 12;
+			start = max(start, first);
+
+			// split [start, end) into maximal aligned blocks
+			while (start < end)
+			{
+				uint32_t order = 0;
+				while (order < MAX_ORDER && !(start & (1 << order)) &&
+						start + (2 << order) <= end)
+					order ++;
+				free_list_insert(start, order);
+				nframes += 1 << order;
+				start += 1 << order;
+			}
 		}
 		mmap_addr += mmap->size + 4;
 	}
 }
 
+uint32_t Page::alloc_frames(int order)
+{
+	kassert(order >= 0 && order <= (int)MAX_ORDER);
+
+	uint32_t k = order;
+	while (k <= MAX_ORDER && !free_list[k])
+		k ++;
+	if (k > MAX_ORDER)
+		return 0;
+
+	uint32_t frame = free_list[k];
+	free_list_remove(frame);
+
+	// give back the upper halves
+	while (k > (uint32_t)order)
+	{
+		k --;
+		free_list_insert(frame + (1 << k), k);
+	}
+
+	nframes -= 1 << order;
+	for (uint32_t i = 0; i < (1u << order); i ++)
+	{
+		frames[frame + i].ref_cnt = 1;
+		frames[frame + i].nshare = 0;
+	}
+
+	return frame << 12;
+}
+
+void Page::free_frames(uint32_t phyaddr, int order)
+{
+	uint32_t frame = phyaddr >> 12;
+	kassert(!(frame & ((1 << order) - 1)));
+
+	nframes += 1 << order;
+	for (uint32_t i = 0; i < (1u << order); i ++)
+		frames[frame + i].ref_cnt = 0;
+
+	// merge with the buddy while it is free as a whole
+	while (order < (int)MAX_ORDER)
+	{
+		uint32_t buddy = frame ^ (1 << order);
+		if (buddy >= nframe_total || !(frames[buddy].flags & Frame_t::FREE) ||
+				frames[buddy].order != order)
+			break;
+		free_list_remove(buddy);
+		frame &= ~(1 << order);
+		order ++;
+	}
+
+	free_list_insert(frame, order);
+}
+
+uint32_t Page::get_nfree_frames()
+{
+	return nframes;
+}
+
+void free_list_insert(uint32_t frame, uint32_t order)
+{
+	Frame_t &f = frames[frame];
+	f.flags |= Frame_t::FREE;
+	f.order = order;
+	f.prev = FRAME_NIL;
+	f.next = free_list[order];
+	if (free_list[order])
+		frames[free_list[order]].prev = frame;
+	free_list[order] = frame;
+}
+
+void free_list_remove(uint32_t frame)
+{
+	Frame_t &f = frames[frame];
+	if (f.prev)
+		frames[f.prev].next = f.next;
+	else
+		free_list[f.order] = f.next;
+	if (f.next)
+		frames[f.next].prev = f.prev;
+	f.flags &= ~Frame_t::FREE;
+}
+
+void Page::refill_zeroed_pool()
+{
+	while (nzeroed < ZEROED_POOL_SIZE && nframes > ZEROED_POOL_MIN_FREE)
+	{
+		// the window used by fill_frame is shared, so do not get preempted
+		uint32_t old_eflags;
+		CLI_SAVE_EFLAGS(old_eflags);
+		if (nzeroed < ZEROED_POOL_SIZE)
+		{
+			uint32_t phyaddr = alloc_frames(0);
+			kassert(phyaddr);
+			fill_frame(phyaddr, 0);
+			zeroed_pool[nzeroed ++] = phyaddr;
+		}
+		RESTORE_EFLAGS(old_eflags);
+	}
+}
+
+void Page::get_zeroed_pool_stat(uint32_t &nfree, uint32_t &nhit, uint32_t &nmiss)
+{
+	nfree = nzeroed;
+	nhit = zeroed_nhit;
+	nmiss = zeroed_nmiss;
+}
+
 void copy_page_physical(uint32_t dest, uint32_t src)
 {
-	empty_page0_ptr->addr = src >> 12;
-	empty_page1_ptr->addr = dest >> 12;
-	invlpg(empty_page0_addr);
-	invlpg(empty_page1_addr);
+	uint32_t src_addr = physmap_addr(src),
+			 dest_addr = physmap_addr(dest);
+	if (!src_addr)
+	{
+		empty_page0_ptr->addr = src >> 12;
+		invlpg(src_addr = empty_page0_addr);
+	}
+	if (!dest_addr)
+	{
+		empty_page1_ptr->addr = dest >> 12;
+		invlpg(dest_addr = empty_page1_addr);
+	}
 	asm volatile
 	(
 		"cld\n"
 		"rep movsl"
-		: : "D"(empty_page1_addr), "S"(empty_page0_addr), "c"(1024)
+		: : "D"(dest_addr), "S"(src_addr), "c"(1024)
 	);
 }
 
+void init_physmap(Multiboot_info_t *mbd)
+{
+	// only available memory is mapped, so that no hole or memory-mapped
+	// device gets a cacheable mapping
+	physmap_end = min(nframe_total << 12, PHYSMAP_SIZE);
+	uint32_t mmap_addr = mbd->mmap_addr;
+	while (mmap_addr < mbd->mmap_addr + mbd->mmap_length)
+	{
+		Multiboot_mmap_entry_t *mmap = (Multiboot_mmap_entry_t*)mmap_addr;
+		mmap_addr += mmap->size + 4;
+		if (mmap->type != MULTIBOOT_MEMORY_AVAILABLE || mmap->addr >= physmap_end)
+			continue;
+
+		uint32_t begin = get_aligned((uint32_t)mmap->addr, 12),
+				 end = (uint32_t)min(mmap->addr + mmap->len, (uint64_t)physmap_end) & 0xFFFFF000;
+		for (uint32_t i = begin; i < end; i += 0x1000)
+		{
+			uint32_t addr = PHYSMAP_BEGIN + i;
+			Directory_entry_t &entry = current_page_dir->entries[addr >> 22];
+			if (pse_enabled && !(i & 0x3FFFFF) && i + 0x400000 <= end && !entry.present)
+			{
+				set_large_page(entry, i);
+				i += 0x3FF000;
+				continue;
+			}
+			Table_entry_t *page = current_page_dir->get_page(addr, true);
+			if (!page)
+				continue; // mapped by a 4mb page of an overlapping region
+			page->present = 1;
+			page->rw = 1;
+			page->user = 0;
+			page->global = 1;
+			page->addr = i >> 12;
+		}
+	}
+}
+
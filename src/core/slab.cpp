@@ -0,0 +1,408 @@
+/*
+ * $File: slab.cpp
+ * $Date: Sun Oct 18 09:02:03 2026 +0800
+ *
+ * slab caches for small kernel objects
+ */
+/*
+This file is part of JKOS
+
+Copyright (C) <2010>  Jiakai <jia.kai66@gmail.com>
+
+JKOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JKOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <slab.h>
+#include <kheap.h>
+#include <klog.h>
+
+using namespace Slab;
+
+/*
+ * The kernel only runs on one CPU for now; NCPU and cpu_id() are where the
+ * per-CPU layer below plugs into SMP. Each CPU owns a loaded and a previous
+ * magazine for every class and touches the shared depot only when both are
+ * exhausted, so refills and flushes happen a magazine at a time.
+ */
+static const int
+	NCPU = 1,
+	MAG_SIZE = 15,		// number of objects a magazine holds
+	DEPOT_FULL_MAX = 4,
+	DEPOT_EMPTY_MAX = 4;
+
+static inline int cpu_id()
+{ return 0; }
+
+struct Slab_t
+{
+	// slab header, placed at the beginning of each slab
+	// objects start at the first object-size boundary after the header
+
+	Slab_t *next, *prev; // neighbours in the partial list of the cache
+	void *free_list; // singly linked list of freed objects
+	uint32_t
+		cls,
+		nused,		// number of allocated objects
+		ncarved;	// number of objects ever taken from the uncarved tail
+
+	inline uint32_t obj_size() const
+	{ return 1 << (cls + OBJ_SHIFT_MIN); }
+
+	inline uint32_t first_obj() const
+	{ return get_aligned((uint32_t)this + sizeof(Slab_t), cls + OBJ_SHIFT_MIN); }
+
+	inline uint32_t capacity() const
+	{ return ((uint32_t)this + SLAB_SIZE - first_obj()) >> (cls + OBJ_SHIFT_MIN); }
+};
+
+struct Magazine_t
+{
+	Magazine_t *next; // next magazine in the depot
+	uint32_t nobj;
+	void *obj[MAG_SIZE];
+};
+
+struct Cpu_cache_t
+{
+	Magazine_t *loaded, *prev;
+	uint32_t nalloc; // number of allocations served by the magazines
+};
+
+struct Cache_t
+{
+	Slab_t *partial; // slabs which still have free objects
+	uint32_t nhit, nmiss, nslab, nobj;
+
+	// the depot
+	Magazine_t *full, *empty;
+	uint32_t nfull, nempty;
+
+	void list_insert(Slab_t *s);
+	void list_remove(Slab_t *s);
+};
+
+static Cache_t caches[NCLASS];
+static Cpu_cache_t cpu_caches[NCPU][NCLASS];
+
+// one bit for each SLAB_SIZE chunk in the kernel heap, set iff it is a slab
+static uint32_t slab_map[(KERNEL_HEAP_END - KERNEL_HEAP_BEGIN) / SLAB_SIZE / 32];
+
+static inline uint32_t get_slab_idx(uint32_t addr)
+{ return (addr - KERNEL_HEAP_BEGIN) >> SLAB_SHIFT; }
+
+// get the slab containing @addr, or NULL if @addr is not in a slab
+static inline Slab_t* get_slab(uint32_t addr)
+{
+	if (addr < KERNEL_HEAP_BEGIN || addr >= KERNEL_HEAP_END)
+		return NULL;
+	uint32_t idx = get_slab_idx(addr);
+	if (!((slab_map[idx >> 5] >> (idx & 31)) & 1))
+		return NULL;
+	return (Slab_t*)(addr & ~(SLAB_SIZE - 1));
+}
+
+static Slab_t* new_slab(uint32_t cls);
+
+// allocate/free an object directly from/to the slabs of a class
+static void* slab_alloc(uint32_t cls);
+static void slab_free(Slab_t *s, void *ptr);
+
+// allocate an object from the magazines of current CPU, NULL if they are all empty
+static void* mag_alloc(uint32_t cls);
+// put a freed object into the magazines of current CPU
+static void mag_free(uint32_t cls, void *ptr);
+
+// give a magazine to the depot; a full one is flushed to the slabs if the depot has enough
+static void depot_put_full(Cache_t &cache, Magazine_t *mag);
+static void depot_put_empty(Cache_t &cache, Magazine_t *mag);
+
+static inline uint32_t get_cls(uint32_t size)
+{
+	uint32_t cls = 0;
+	while ((1u << (cls + OBJ_SHIFT_MIN)) < size)
+		cls ++;
+	return cls;
+}
+
+// class of magazines themselves, which are allocated by slab_alloc
+static inline uint32_t mag_cls()
+{ return get_cls(sizeof(Magazine_t)); }
+
+
+void* Slab::alloc(uint32_t size, int palign)
+{
+	if (size > OBJ_SIZE_MAX || palign > OBJ_SHIFT_MAX)
+		return NULL;
+
+	uint32_t cls = get_cls(max(size, (uint32_t)1 << palign));
+
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	void *ret = mag_alloc(cls);
+	if (!ret)
+		ret = slab_alloc(cls);
+	caches[cls].nobj ++;
+
+	RESTORE_EFLAGS(old_eflags);
+	return ret;
+}
+
+bool Slab::free(void *ptr)
+{
+	uint32_t addr = (uint32_t)ptr;
+	Slab_t *s = get_slab(addr);
+	if (!s)
+		return false;
+
+	if (addr < s->first_obj() || ((addr - s->first_obj()) & (s->obj_size() - 1)))
+		panic("trting to free invalid memory: addr=%p", ptr);
+
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	mag_free(s->cls, ptr);
+	caches[s->cls].nobj --;
+
+	RESTORE_EFLAGS(old_eflags);
+	return true;
+}
+
+void* mag_alloc(uint32_t cls)
+{
+	Cpu_cache_t &cc = cpu_caches[cpu_id()][cls];
+	if (!cc.loaded || !cc.loaded->nobj)
+	{
+		if (cc.prev && cc.prev->nobj)
+		{
+			Magazine_t *tmp = cc.loaded;
+			cc.loaded = cc.prev;
+			cc.prev = tmp;
+		}
+		else
+		{
+			Cache_t &cache = caches[cls];
+			if (!cache.full)
+				return NULL;
+
+			if (cc.prev)
+				depot_put_empty(cache, cc.prev);
+			cc.prev = cc.loaded;
+			cc.loaded = cache.full;
+			cache.full = cache.full->next;
+			cache.nfull --;
+		}
+	}
+
+	cc.nalloc ++;
+	return cc.loaded->obj[-- cc.loaded->nobj];
+}
+
+void mag_free(uint32_t cls, void *ptr)
+{
+	Cpu_cache_t &cc = cpu_caches[cpu_id()][cls];
+	if (!cc.loaded || cc.loaded->nobj == MAG_SIZE)
+	{
+		if (cc.prev && cc.prev->nobj < MAG_SIZE)
+		{
+			Magazine_t *tmp = cc.loaded;
+			cc.loaded = cc.prev;
+			cc.prev = tmp;
+		}
+		else
+		{
+			Cache_t &cache = caches[cls];
+			Magazine_t *mag = cache.empty;
+			if (mag)
+			{
+				cache.empty = mag->next;
+				cache.nempty --;
+			}
+			else
+			{
+				mag = static_cast<Magazine_t*>(slab_alloc(mag_cls()));
+				mag->nobj = 0;
+			}
+
+			if (cc.prev)
+				depot_put_full(cache, cc.prev);
+			cc.prev = cc.loaded;
+			cc.loaded = mag;
+		}
+	}
+
+	cc.loaded->obj[cc.loaded->nobj ++] = ptr;
+}
+
+void depot_put_full(Cache_t &cache, Magazine_t *mag)
+{
+	if (cache.nfull == DEPOT_FULL_MAX)
+	{
+		// the depot is full, so give the objects back to the slabs
+		for (uint32_t i = 0; i < mag->nobj; i ++)
+		{
+			void *ptr = mag->obj[i];
+			slab_free((Slab_t*)((uint32_t)ptr & ~(SLAB_SIZE - 1)), ptr);
+		}
+		mag->nobj = 0;
+		depot_put_empty(cache, mag);
+		return;
+	}
+
+	mag->next = cache.full;
+	cache.full = mag;
+	cache.nfull ++;
+}
+
+void depot_put_empty(Cache_t &cache, Magazine_t *mag)
+{
+	if (cache.nempty == DEPOT_EMPTY_MAX)
+	{
+		slab_free((Slab_t*)((uint32_t)mag & ~(SLAB_SIZE - 1)), mag);
+		return;
+	}
+
+	mag->next = cache.empty;
+	cache.empty = mag;
+	cache.nempty ++;
+}
+
+void* slab_alloc(uint32_t cls)
+{
+	Cache_t &cache = caches[cls];
+	Slab_t *s = cache.partial;
+	if (s)
+		cache.nhit ++;
+	else
+	{
+		cache.nmiss ++;
+		cache.list_insert(s = new_slab(cls));
+	}
+
+	void *ret;
+	if (s->free_list)
+	{
+		ret = s->free_list;
+		s->free_list = *static_cast<void**>(ret);
+	}
+	else
+		ret = (void*)(s->first_obj() + (s->ncarved ++) * s->obj_size());
+
+	if ((++ s->nused) == s->capacity())
+		cache.list_remove(s);
+
+	return ret;
+}
+
+void slab_free(Slab_t *s, void *ptr)
+{
+	Cache_t &cache = caches[s->cls];
+	if (s->nused == s->capacity())
+		cache.list_insert(s);
+
+	*static_cast<void**>(ptr) = s->free_list;
+	s->free_list = ptr;
+	s->nused --;
+
+	if (!s->nused && (s->next != s))
+	{
+		// give the slab back to the heap, but always keep one for this class
+		cache.list_remove(s);
+		cache.nslab --;
+		uint32_t idx = get_slab_idx((uint32_t)s);
+		slab_map[idx >> 5] &= ~(1u << (idx & 31));
+		kheap_free_block(s);
+	}
+}
+
+uint32_t Slab::get_obj_size(const void *ptr)
+{
+	Slab_t *s = get_slab((uint32_t)ptr);
+	return s ? s->obj_size() : 0;
+}
+
+void Slab::get_class_stat(int cls, Class_stat_t &stat)
+{
+	kassert(cls >= 0 && cls < NCLASS);
+	const Cache_t &cache = caches[cls];
+	stat.size = 1 << (cls + OBJ_SHIFT_MIN);
+	stat.nmag = 0;
+	for (int i = 0; i < NCPU; i ++)
+		stat.nmag += cpu_caches[i][cls].nalloc;
+	stat.nhit = cache.nhit;
+	stat.nmiss = cache.nmiss;
+	stat.nslab = cache.nslab;
+	stat.nobj = cache.nobj;
+}
+
+Slab_t* new_slab(uint32_t cls)
+{
+	Slab_t *s = static_cast<Slab_t*>(kheap_alloc_block(SLAB_SIZE, SLAB_SHIFT));
+	s->free_list = NULL;
+	s->cls = cls;
+	s->nused = 0;
+	s->ncarved = 0;
+
+	uint32_t idx = get_slab_idx((uint32_t)s);
+	slab_map[idx >> 5] |= 1u << (idx & 31);
+	caches[cls].nslab ++;
+	return s;
+}
+
+void Cache_t::list_insert(Slab_t *s)
+{
+	if (!partial)
+	{
+		partial = s;
+		s->next = s->prev = s;
+	}
+	else
+	{
+		s->next = partial->next;
+		s->next->prev = s;
+		partial->next = s;
+		s->prev = partial;
+	}
+}
+
+void Cache_t::list_remove(Slab_t *s)
+{
+	if (s->next == s)
+	{
+		kassert(partial == s);
+		partial = NULL;
+	}
+	else
+	{
+		if (partial == s)
+			partial = s->next;
+		s->prev->next = s->next;
+		s->next->prev = s->prev;
+	}
+}
+
+#ifdef _DEBUG_BUILD_
+void Slab::output_debug_msg()
+{
+	Klog::puts("slab caches (size: magazine hit miss slabs objects):\n");
+	for (int i = 0; i < NCLASS; i ++)
+	{
+		Class_stat_t stat;
+		get_class_stat(i, stat);
+		Klog::printf(" * %d: %d %d %d %d %d\n", stat.size, stat.nmag, stat.nhit,
+				stat.nmiss, stat.nslab, stat.nobj);
+	}
+}
+#endif // _DEBUG_BUILD_
+
@@ -1,6 +1,6 @@
 /*
  * $File: syscall.cpp
- * $Date: Wed Dec 29 19:41:15 2010 +0800
+ * $Date: Sun Oct 18 10:07:11 2026 +0800
  *
  * interface for implementing system calls
  */
@@ -26,10 +26,20 @@ along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
 #include <asm.h>
 #include <klog.h>
 #include <task.h>
+#include <timer.h>
+#include <kheap.h>
+#include <errno.h>
+#include <drv/ramdisk.h>
 
 extern "C" uint32_t syscall_func_addr[NR_SYSCALLS];
 
 static int sys_sleep(pid_t pid, const Sigset *sig_wakeup);
+static int sys_kheap_stat(pid_t pid, Kheap_stat_t *stat);
+static pid_t sys_spawn(const char *name, const char * const *argv);
+static int sys_get_nice(pid_t pid, int *nice);
+static int sys_nanosleep(const Timer::Timespec_t *req, Timer::Timespec_t *rem);
+static pid_t sys_waitpid(pid_t pid, int *status);
+static int sys_exec(const char *name, const char * const *argv);
 
 uint32_t syscall_func_addr[NR_SYSCALLS] =
 {
@@ -37,7 +47,17 @@ uint32_t syscall_func_addr[NR_SYSCALLS] =
 	(uint32_t)Task::fork,
 	(uint32_t)Task::getpid,
 	(uint32_t)sys_sleep,
-	(uint32_t)Task::wakeup
+	(uint32_t)Task::wakeup,
+	(uint32_t)sys_kheap_stat,
+	(uint32_t)kheap_get_site_stat,
+	(uint32_t)sys_spawn,
+	(uint32_t)Task::set_nice,
+	(uint32_t)sys_get_nice,
+	(uint32_t)sys_nanosleep,
+	(uint32_t)Task::exit,
+	(uint32_t)sys_waitpid,
+	(uint32_t)Task::vfork,
+	(uint32_t)sys_exec
 };
 
 static int sys_sleep(pid_t pid, const Sigset *sig_wakeup)
@@ -45,3 +65,56 @@ static int sys_sleep(pid_t pid, const Sigset *sig_wakeup)
 	return Task::sleep(pid, *sig_wakeup);
 }
 
+static int sys_kheap_stat(pid_t pid, Kheap_stat_t *stat)
+{
+	kheap_get_stat(*stat);
+	return Task::get_kmem_stat(pid, stat->task_nbytes_alloc, stat->task_nbytes_free);
+}
+
+static pid_t sys_spawn(const char *name, const char * const *argv)
+{
+	Fs::Node_file *file = ramdisk_open(name);
+	if (!file)
+		ERROR_RETURN(ENOENT);
+	pid_t pid = Task::spawn(file, argv);
+	if (pid == (pid_t)-1)
+		delete file;
+	return pid;
+}
+
+static int sys_get_nice(pid_t pid, int *nice)
+{
+	return Task::get_nice(pid, *nice);
+}
+
+static int sys_nanosleep(const Timer::Timespec_t *req, Timer::Timespec_t *rem)
+{
+	if (req->nsec >= 1000000000)
+		ERROR_RETURN(EINVAL);
+
+	uint32_t left = Task::sleep_timeout(Timer::timespec2ticks(*req), Sigset());
+	if (!left)
+		return 0;
+	if (rem)
+		Timer::ticks2timespec(left, *rem);
+	ERROR_RETURN(EINTR);
+}
+
+static pid_t sys_waitpid(pid_t pid, int *status)
+{
+	int tmp;
+	pid_t ret = Task::waitpid(pid, tmp);
+	if (ret != (pid_t)-1 && status)
+		*status = tmp;
+	return ret;
+}
+
+static int sys_exec(const char *name, const char * const *argv)
+{
+	Fs::Node_file *file = ramdisk_open(name);
+	if (!file)
+		ERROR_RETURN(ENOENT);
+	Task::exec(file, argv);
+	delete file;
+	return -1;
+}
@@ -1,6 +1,6 @@
 /*
  * $File: task.cpp
- * $Date: Wed Dec 29 16:26:43 2010 +0800
+ * $Date: Sun Oct 18 10:07:53 2026 +0800
  *
  * task scheduling and managing
  */
@@ -31,7 +31,9 @@ along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
 #include <kheap.h>
 #include <descriptor_table.h>
 #include <user.h>
+#include <elf.h>
 #include <errno.h>
+#include <timer.h>
 #include <lib/cstring.h>
 #include <lib/rbtree.h>
 
@@ -39,6 +41,7 @@ using namespace Task;
 
 // struct and type definitions
 struct Task_t;
+struct Prio_array_t;
 struct Pair_id_task
 {
 	pid_t id;
@@ -48,35 +51,95 @@ struct Pair_id_task
 };
 typedef Rbt<Pair_id_task> Rbt_id_task;
 
+struct Pair_vrt_task
+{
+	uint64_t vruntime;
+	Task_t *task;
+	inline bool operator < (const Pair_vrt_task &p) const
+	{ return vruntime < p.vruntime || (vruntime == p.vruntime && task < p.task); }
+	inline bool operator <= (const Pair_vrt_task &p) const
+	{ return !(p < *this); }
+};
+typedef Rbt<Pair_vrt_task> Rbt_vrt_task;
+
 enum Task_state_t {TS_RUNNING, TS_SLEEPING, TS_ZOMBIE};
 
+struct Spawn_info_t
+{
+	// what a spawned task should execute
+
+	Fs::Node_file *file;
+	uint32_t argc,
+			 args_size; // total length of the arguments, including the terminating zeros
+	char args[]; // the arguments, one after another
+};
+
 struct Task_t
 {
 	pid_t id;
-	uint32_t esp, ebp, eip;
+	uint32_t esp; // kernel stack pointer saved by switch_context
 	Page::Directory_t *page_dir;
+	void *kstack; // lowest address of the kernel stack of this task
 
 	Task_state_t state;
 
+	// scheduling state, see Sched_class below
+	int nice,
+		prio; // dynamic priority used by the priority scheduler, 0 is the highest
+	uint32_t
+		time_slice,		// number of ticks left in current time slice
+		sleep_avg,		// increased by ticks slept and decreased by ticks run
+		sleep_start;	// tick when the task went to sleep
+	Prio_array_t *array; // the priority array containing this task, NULL if not runnable
+	uint64_t vruntime; // weighted run time used by the fair scheduler
+
 	uid_t uid;
 	gid_t gid;
 
 	int errno; // saved error number of current task
 
+	uint32_t kmem_alloc, kmem_free; // bytes of kernel heap ever allocated/freed by this task
+
 	Task_t
 		*par, // parent task
 		*queue_next, *queue_prev; // next and previuos task in the task queue
 
 	Sigset sig_wakeup;
 
-	Task_t(Page::Directory_t *dir);
+	Spawn_info_t *spawn_info; // non-NULL iff this task is spawned and has not started yet
+
+	// whether this task runs in the address space of its parent, which
+	// waits in vfork() until the task calls exec() or exits
+	bool vfork_borrowed;
+
+	// what a kernel thread runs, see Task::kernel_thread()
+	void (*thread_entry)(void *arg);
+	void *thread_arg;
+
+	int exit_status;
+	Task_t
+		*first_child, // children not reaped yet, linked through their sibling pointers
+		*sibling_next, *sibling_prev;
+	Wait_queue_t child_wait; // where waitpid() waits for a child to exit
+
+	Task_t(pid_t id, Page::Directory_t *dir);
+
+	/*
+	 * A Task_t is never given back to the kernel heap: the first time its
+	 * memory is allocated, the node memory below is donated to the pools of
+	 * the id tree and the fair scheduler, and since erasing from a tree may
+	 * move a key to another node, the donated nodes do not follow their
+	 * tasks. So freed Task_t objects are kept for reuse instead.
+	 */
+	static void* operator new(size_t size);
+	static void operator delete(void *ptr);
 
 	static void *rbt_alloc();
-	static void rbt_free(void *);
+	static void rbt_free(void *node);
 
 private:
-	uint8_t rbt_node_mem[sizeof(Rbt_id_task::Node) + 1];
-	static Task_t *latest_task;
+	uint8_t rbt_node_mem[sizeof(Rbt_id_task::Node) + 1],
+			fair_node_mem[sizeof(Rbt_vrt_task::Node) + 1];
 };
  
 struct Task_queue
@@ -93,33 +156,297 @@ struct Task_queue
 	void remove(Task_t *task);
 };
 
+/*
+ * A scheduling class keeps the runnable tasks and decides which one runs
+ * next. The class is chosen at boot and never changes afterwards; all the
+ * methods are called with interrupts disabled.
+ */
+class Sched_class
+{
+public:
+	virtual const char* get_name() const = 0;
+
+	// add a task which has just been created (@wakeup is false) or woken up
+	virtual void enqueue(Task_t *task, bool wakeup) = 0;
+
+	// remove a task which is no longer runnable
+	virtual void dequeue(Task_t *task) = 0;
+
+	// get the runnable task to run next, or NULL if there is none
+	virtual Task_t* pick_next() = 0;
+
+	// charge a tick to the running @task, return whether it should be preempted
+	virtual bool tick(Task_t *task) = 0;
+
+	// the running @task gives up the CPU
+	virtual void yield(Task_t *task) = 0;
+
+	// whether the runnable @task should preempt current task
+	virtual bool preempt(const Task_t *task) = 0;
+
+	// initialize the state of @child, which is created by current task
+	virtual void fork(Task_t *child) = 0;
+
+	// change the nice value of @task
+	virtual void renice(Task_t *task, int nice) = 0;
+};
+
+/*
+ * The priority scheduler keeps runnable tasks in two priority arrays,
+ * active and expired. An array has a task queue for every priority and a
+ * bitmap of the non-empty queues, so the next task is found by scanning for
+ * the first set bit. When a task uses up its time slice, it gets a new one
+ * and is moved to the expired array; when the active array becomes empty,
+ * the two are swapped. Tasks which sleep much get a priority bonus of up to
+ * MAX_BONUS levels.
+ */
+static const int
+	NPRIO = NICE_MAX - NICE_MIN + 1,
+	PRIO_BITMAP_SIZE = (NPRIO + 31) / 32,
+	MAX_BONUS = 5;
+static const uint32_t MAX_SLEEP_AVG = KERNEL_HZ; // in ticks
+
+struct Prio_array_t
+{
+	uint32_t nactive, // number of tasks in this array
+			 bitmap[PRIO_BITMAP_SIZE];
+	Task_queue queue[NPRIO];
+
+	void insert(Task_t *task);
+	void remove(Task_t *task);
+
+	// get the first task of the highest priority, or NULL if empty
+	Task_t* first() const;
+};
+
+class Sched_prio : public Sched_class
+{
+	Prio_array_t arrays[2], *active, *expired;
+
+public:
+	Sched_prio() : active(arrays), expired(arrays + 1) {}
+
+	const char* get_name() const
+	{ return "priority"; }
+
+	void enqueue(Task_t *task, bool wakeup);
+	void dequeue(Task_t *task);
+	Task_t* pick_next();
+	bool tick(Task_t *task);
+	void yield(Task_t *task);
+	bool preempt(const Task_t *task);
+	void fork(Task_t *child);
+	void renice(Task_t *task, int nice);
+};
+
+/*
+ * The fair scheduler keys runnable tasks (including the running one) by
+ * their virtual run time in a red-black tree, and always runs the leftmost
+ * one. Every tick adds to the virtual run time of the running task an
+ * amount inversely proportional to its weight, which is determined by its
+ * nice value; so tasks get CPU time in proportion to their weights.
+ * A task is preempted once it is more than FAIR_GRANULARITY ahead of the
+ * leftmost one; a woken task is placed no further than FAIR_SLEEPER_CREDIT
+ * behind min_vruntime, so that sleeping does not bank unlimited CPU time.
+ */
+static const uint32_t
+	NICE_0_WEIGHT = 1024,
+	TICK_VRUNTIME = 1024, // virtual run time of a tick at nice 0
+	FAIR_GRANULARITY = TICK_VRUNTIME,
+	FAIR_SLEEPER_CREDIT = TICK_VRUNTIME * 2;
+
+class Sched_fair : public Sched_class
+{
+	Rbt_vrt_task queue;
+	// monotonic lower bound of the virtual run time of runnable tasks
+	uint64_t min_vruntime;
+
+	static void* node_alloc();
+	static void node_free(void *node);
+
+	// get the node of runnable @task
+	Rbt_vrt_task::Node* find(const Task_t *task);
+	Task_t* leftmost();
+	void insert(Task_t *task);
+	void update_min_vruntime();
+
+public:
+	Sched_fair() : queue(node_alloc, node_free), min_vruntime(0) {}
+
+	const char* get_name() const
+	{ return "fair"; }
+
+	void enqueue(Task_t *task, bool wakeup);
+	void dequeue(Task_t *task);
+	Task_t* pick_next();
+	bool tick(Task_t *task);
+	void yield(Task_t *task);
+	bool preempt(const Task_t *task);
+	void fork(Task_t *child);
+	void renice(Task_t *task, int nice);
+};
+
+struct Node_pool_t
+{
+	// free tree nodes, linked through their first word
+	// every task donates the memory of one node, so a pool never runs out
+
+	void *head;
+
+	void* get();
+	void put(void *node);
+};
+
 
 
 // variable definitions
 static bool switch_to_user_mode_called = false;
 static Task_t *current_task;
+
+// the idle task runs when no other task is runnable; it is in no run queue,
+// and can not be the target of sleep, wakeup and such
+static Task_t *idle_task;
 static Rbt_id_task rbt_id2task(Task_t::rbt_alloc, Task_t::rbt_free);
-Task_t *Task_t::latest_task;
+static Node_pool_t id_node_pool, fair_node_pool;
+static Task_t *task_cache; // reaped Task_t objects, linked through their first word
 extern "C" uint32_t initial_stack_pointer; // defined in loader.s
 namespace Queue
 {
-	Task_queue running, sleeping, zombie;
+	Task_queue sleeping,
+			   orphan; // zombies whose parents have exited; they are reaped by the idle task
 }
 
+static Sched_prio sched_prio;
+static Sched_fair sched_fair;
+static Sched_class *sched = &sched_prio;
+
 
 // function declarations
 
-// move the stack out of kernel pages
-// (to avoid being linked when cloing page directories)
-static void move_stack();
+// move the boot stack to the kernel stack whose highest address plus 1 is @top
+static void move_stack(uint32_t top);
+
+/*
+ * Every task has its own kernel stack of KERNEL_STACK_SIZE bytes in the
+ * kernel heap, which is mapped in all address spaces. Stacks of reaped
+ * tasks are kept in a small cache for reuse.
+ */
+static const uint32_t STACK_CACHE_SIZE = 8;
+static void *stack_cache[STACK_CACHE_SIZE];
+static uint32_t nstack_cached;
+
+static void* kstack_alloc();
+static void kstack_free(void *stack);
+
+static inline uint32_t kstack_top(const Task_t *task)
+{ return (uint32_t)task->kstack + KERNEL_STACK_SIZE; }
 
 static inline Task_t* id2task(pid_t pid);
-static inline pid_t get_next_pid();
-static inline void switch_task(Task_t *t, uint32_t old_eflags) __attribute__((noreturn));
-static inline Task_t* get_next_task();
+
+// pids are recycled below PID_MAX; a pid is not reused until its task is reaped
+// return -1 if all the pids are in use
+static const pid_t PID_MAX = 32768;
+static pid_t get_next_pid();
+
+// release everything left of zombie @task
+// must be called with interrupts disabled
+static void reap(Task_t *task);
+
+// find a zombie child of @par
+static Task_t* find_zombie(const Task_t *par);
+
+// add @child to / remove it from the child list of its parent
+static void link_child(Task_t *child);
+static void unlink_child(Task_t *child);
+
+// make the children of the exiting @task orphans
+// must be called with interrupts disabled
+static void orphan_children(Task_t *task);
+
+// stop running @prev and continue @next; return when @prev is switched back to
+// must be called with interrupts disabled
+static void switch_to(Task_t *prev, Task_t *next);
+
+// get the task to run next, which is the idle task if no task is runnable
+static inline Task_t* pick_next();
+
+// halt the CPU with the periodic tick stopped, until some task is runnable
+static void idle_main() __attribute__((noreturn));
+
+// set up the kernel stack of a new task, so that it starts at @entry when first switched to
+static void init_context(Task_t *task, void (*entry)());
+
+// put @task to sleep / wake it up; must be called with interrupts disabled
+static void sleep_task(Task_t *task, const Sigset &sig_wakeup);
+static void wake_task(Task_t *task);
+
+// make a sleeping @task runnable without switching to it
+// return whether it should preempt current task, in which case need_resched is also set
+static bool make_runnable(Task_t *task);
+
+// whether current task should be preempted at the next Task::tick(); timer
+// callbacks only set this, since they must not switch tasks
+static bool need_resched;
+
+static void wait_queue_insert(Wait_queue_t &wq, Wait_entry_t *entry);
+static void wait_queue_remove(Wait_entry_t *entry);
+
+// wake up the waiters on @wq, all of them or only one exclusive waiter
+static void wake_up(Wait_queue_t &wq, bool all);
+
+// like wake_up(), but do not switch; return whether current task should be preempted
+// must be called with interrupts disabled
+static bool wake_up_locked(Wait_queue_t &wq, bool all);
+
+// timer callback of sleep_timeout()
+static void timeout_wakeup(void *task);
+
+// number of ticks in a time slice of a task with nice value @nice
+static inline uint32_t slice_ticks(int nice);
+static inline int effective_prio(const Task_t *task);
+
+// virtual run time charged to a task with nice value @nice for a tick
+static inline uint32_t tick_vruntime(int nice);
+
+// make a newly created task runnable
+static void sched_fork(Task_t *child);
+
+// whether the space-separated option list @cmdline contains @opt
+static bool cmdline_has(const char *cmdline, const char *opt);
+
+// the first code run by a spawned task, or by a task after exec(), in its
+// own address space
+static void spawn_start() __attribute__((noreturn));
+
+// the first code run by a kernel thread
+static void thread_start() __attribute__((noreturn));
+
+// the address space of a new child
+enum Child_mm_t
+{
+	CHILD_MM_CLONE,	// a copy-on-write copy of current address space
+	CHILD_MM_NEW,	// only the kernel mappings
+	CHILD_MM_SHARE	// current address space itself
+};
+
+// create a child of current task with a fresh kernel stack and address
+// space given by @mm; the child is not runnable yet
+// return NULL if no pid is available
+// must be called with interrupts disabled
+static Task_t* new_child(Child_mm_t mm);
+
+// make @child return 0 from the system call current task is in
+static void copy_syscall_frame(Task_t *child);
+
+// pack @file and the NULL-terminated argument list @argv for spawn_start()
+// return NULL if the arguments do not fit in the user stack page
+static Spawn_info_t* make_spawn_info(Fs::Node_file *file, const char * const *argv);
 
 // defined in misc.s
-extern "C" uint32_t read_eip();
+extern "C" void switch_context(uint32_t *prev_esp, uint32_t next_esp);
+
+// defined in syscall.s
+extern "C" void fork_child_return();
 
 // check whether current task has permission to operate on target task
 // if permission denied, errno is set and -1 is returned
@@ -148,7 +475,7 @@ do \
 #define GET_TASK_BY_ID_NOZOMBIE(_id_) \
 ({ \
 	 Task_t *t = id2task(_id_); \
-	 if (!t || t->state == TS_ZOMBIE) \
+	 if (!t || t->state == TS_ZOMBIE || t == idle_task) \
 	 { \
 		set_errno(ESRCH); \
 		return -1; \
@@ -160,19 +487,35 @@ do \
 
 // function implementations
 
-void Task::init()
+void Task::init(const char *cmdline)
 {
-	move_stack();
+	if (cmdline_has(cmdline, "sched=fair"))
+		sched = &sched_fair;
+
+	void *stack = kstack_alloc();
+	move_stack((uint32_t)stack + KERNEL_STACK_SIZE);
 
 	// initialise the first task (kernel task)
-	current_task = new Task_t(Page::current_page_dir);
+	current_task = new Task_t(get_next_pid(), Page::current_page_dir);
+	current_task->kstack = stack;
 	current_task->uid = 0;
 	current_task->gid = 0;
-	Queue::running.insert(current_task);
-
+	current_task->time_slice = slice_ticks(0);
+	sched->enqueue(current_task, false);
+
+	// the idle task has a directory of its own, so that exiting tasks can
+	// switch to it before freeing theirs
+	idle_task = new Task_t(get_next_pid(), Page::new_directory());
+	idle_task->kstack = kstack_alloc();
+	idle_task->uid = 0;
+	idle_task->gid = 0;
+	init_context(idle_task, idle_main);
+
+	// system calls enter on the kernel stack set here (later by switch_to)
+	set_kernel_stack(kstack_top(current_task));
 	schedule();
 
-	Klog::log(Klog::INFO, "tasking initialized");
+	Klog::log(Klog::INFO, "tasking initialized, scheduler: %s", sched->get_name());
 }
 
 pid_t Task::fork()
@@ -180,37 +523,118 @@ pid_t Task::fork()
 	uint32_t old_eflags;
 	CLI_SAVE_EFLAGS(old_eflags);
 
-	uint32_t eip;
-	Task_t *par_task = current_task, *child;
+	Task_t *child = new_child(CHILD_MM_CLONE);
+	if (!child)
+	{
+		RESTORE_EFLAGS(old_eflags);
+		ERROR_RETURN(EAGAIN);
+	}
+	copy_syscall_frame(child);
+	sched_fork(child);
 
-	child = new Task_t(Page::clone_directory(Page::current_page_dir));
-	child->par = par_task;
-	child->uid = par_task->uid;
-	child->gid = par_task->gid;
-	Queue::running.insert(child);
+	RESTORE_EFLAGS(old_eflags);
+	return child->id;
+}
 
-	eip = read_eip();
+pid_t Task::vfork()
+{
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
 
-	if (current_task == par_task)
+	Task_t *task = current_task, *child = new_child(CHILD_MM_SHARE);
+	if (!child)
 	{
-		// we are the parent task
-		asm volatile
-		(
-			"mov %%esp, %0\n"
-			"mov %%ebp, %1\n"
-			: "=g"(child->esp), "=g"(child->ebp)
-		);
-		child->eip = eip;
-		// so upon next scheduling, child will be started executing at
-		// read_eip() above
-
 		RESTORE_EFLAGS(old_eflags);
-		return child->id;
+		ERROR_RETURN(EAGAIN);
+	}
+	copy_syscall_frame(child);
+	child->vfork_borrowed = true;
+	sched_fork(child);
+
+	// the child can not be reaped before we return, since only we can reap it
+	while (child->vfork_borrowed)
+		wait(task->child_wait, false);
+
+	RESTORE_EFLAGS(old_eflags);
+	return child->id;
+}
+
+pid_t Task::kernel_thread(void (*entry)(void *arg), void *arg)
+{
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
 
+	Task_t *child = new_child(CHILD_MM_CLONE);
+	if (!child)
+	{
+		RESTORE_EFLAGS(old_eflags);
+		ERROR_RETURN(EAGAIN);
 	}
+	child->thread_entry = entry;
+	child->thread_arg = arg;
+	init_context(child, thread_start);
+	sched_fork(child);
+
+	RESTORE_EFLAGS(old_eflags);
+	return child->id;
+}
+
+Task_t* new_child(Child_mm_t mm)
+{
+	pid_t pid = get_next_pid();
+	if (pid == (pid_t)-1)
+		return NULL;
+
+	// allocate the stack first, so that the heap table under it is already
+	// linked in the directory to be cloned
+	void *kstack = kstack_alloc();
+	Page::Directory_t *dir = Page::current_page_dir;
+	if (mm == CHILD_MM_CLONE)
+		dir = Page::clone_directory(dir);
+	else if (mm == CHILD_MM_NEW)
+		dir = Page::new_directory();
+	Task_t *par = current_task, *child = new Task_t(pid, dir);
+	child->kstack = kstack;
+	child->par = par;
+	link_child(child);
+	child->uid = par->uid;
+	child->gid = par->gid;
+	return child;
+}
+
+void copy_syscall_frame(Task_t *child)
+{
+	// only the syscall frame is copied, so nothing on the kernel stack of
+	// the child points into that of the parent; the child returns to user
+	// mode from fork_child_return, with the context below the frame as if
+	// saved by switch_context
+	uint32_t top = kstack_top(current_task), child_top = kstack_top(child);
+	memcpy((void*)(child_top - SYSCALL_FRAME_SIZE), (void*)(top - SYSCALL_FRAME_SIZE),
+			SYSCALL_FRAME_SIZE);
+	uint32_t *stack = (uint32_t*)(child_top - SYSCALL_FRAME_SIZE) - 5;
+	memset(stack, 0, sizeof(uint32_t) * 4);
+	stack[4] = (uint32_t)fork_child_return;
+	child->esp = (uint32_t)stack;
+}
+
+void thread_start()
+{
+	asm volatile ("sti");
+	current_task->thread_entry(current_task->thread_arg);
+	Task::exit(0);
+}
+
+void Task::tick()
+{
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	Task_t *task = current_task;
+	bool preempt = task == idle_task ? sched->pick_next() != NULL : sched->tick(task);
+	if (preempt || need_resched)
+		switch_to(task, pick_next());
 
 	RESTORE_EFLAGS(old_eflags);
-	return 0;
 }
 
 void Task::schedule()
@@ -218,23 +642,126 @@ void Task::schedule()
 	uint32_t old_eflags;
 	CLI_SAVE_EFLAGS(old_eflags);
 
-	uint32_t esp, ebp, eip;
-	asm volatile
-	(
-		"mov %%esp, %0\n"
-		"mov %%ebp, %1\n"
-		: "=g"(esp), "=g"(ebp)
-	);
-	eip = read_eip();
+	Task_t *task = current_task;
+	if (task != idle_task)
+		sched->yield(task);
+	switch_to(task, pick_next());
+
+	RESTORE_EFLAGS(old_eflags);
+}
+
+pid_t Task::spawn(Fs::Node_file *file, const char * const *argv)
+{
+	Spawn_info_t *info = make_spawn_info(file, argv);
+	if (!info)
+		ERROR_RETURN(E2BIG);
+
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	Task_t *child = new_child(CHILD_MM_NEW);
+	if (!child)
+	{
+		RESTORE_EFLAGS(old_eflags);
+		kfree(info);
+		ERROR_RETURN(EAGAIN);
+	}
+	child->spawn_info = info;
 
-	if (eip == 0xFFFFFFFF)
-		return; // we have just switched to this task
+	init_context(child, spawn_start);
+	sched_fork(child);
 
-	current_task->esp = esp;
-	current_task->ebp = ebp;
-	current_task->eip = eip;
+	RESTORE_EFLAGS(old_eflags);
+	return child->id;
+}
 
-	switch_task(get_next_task(), old_eflags);
+int Task::exec(Fs::Node_file *file, const char * const *argv)
+{
+	Spawn_info_t *info = make_spawn_info(file, argv);
+	if (!info)
+		ERROR_RETURN(E2BIG);
+
+	asm volatile ("cli");
+
+	// continue as a spawned task in a new address space; a borrowed one is
+	// given back to the parent waiting in vfork()
+	Task_t *task = current_task;
+	Page::Directory_t *dir = task->page_dir;
+	task->page_dir = Page::new_directory();
+	task->page_dir->enable();
+	if (task->vfork_borrowed)
+	{
+		task->vfork_borrowed = false;
+		wake_up_locked(task->par->child_wait, true);
+	}
+	else
+		Page::free_directory(dir);
+
+	task->spawn_info = info;
+	spawn_start();
+}
+
+Spawn_info_t* make_spawn_info(Fs::Node_file *file, const char * const *argv)
+{
+	uint32_t argc = 0, args_size = 0;
+	while (argv[argc])
+		args_size += strlen(argv[argc ++]) + 1;
+
+	// the arguments, the pointers to them, argc and argv must fit in the stack page
+	if (args_size + (argc + 1) * sizeof(char*) + 4 * sizeof(uint32_t) > 0x1000)
+		return NULL;
+
+	Spawn_info_t *info = static_cast<Spawn_info_t*>(kmalloc(sizeof(Spawn_info_t) + args_size));
+	info->file = file;
+	info->argc = argc;
+	info->args_size = args_size;
+	char *ptr = info->args;
+	for (uint32_t i = 0; i < argc; i ++)
+	{
+		strcpy(ptr, argv[i]);
+		ptr += strlen(argv[i]) + 1;
+	}
+	return info;
+}
+
+void spawn_start()
+{
+	asm volatile ("sti");
+	Spawn_info_t *info = current_task->spawn_info;
+	current_task->spawn_info = NULL;
+
+	int entry = load_elf(info->file);
+	delete info->file;
+	if (entry == -1)
+	{
+		Klog::log(Klog::ERROR, "spawn: failed to load elf: errno=%d", current_task->errno);
+		kfree(info);
+		Task::exit(-1);
+	}
+
+	// build the user stack: the arguments at the top, then argv[], argv, argc
+	// and a zero return address
+	Page::current_page_dir->get_page(SPAWN_STACK_PAGE, true)->alloc(true, true);
+	uint32_t top = SPAWN_STACK_PAGE + 0x1000,
+			 args = (top - info->args_size) & ~3u;
+	memcpy((void*)args, info->args, info->args_size);
+
+	uint32_t *esp = (uint32_t*)args - (info->argc + 1);
+	char *arg = (char*)args;
+	for (uint32_t i = 0; i < info->argc; i ++)
+	{
+		esp[i] = (uint32_t)arg;
+		arg += strlen(arg) + 1;
+	}
+	esp[info->argc] = 0;
+	uint32_t argv = (uint32_t)esp;
+	*(-- esp) = argv;
+	*(-- esp) = info->argc;
+	*(-- esp) = 0;
+
+	kfree(info);
+	switch_to_user_mode(entry, (uint32_t)esp);
+	for (; ;);
 }
 
 pid_t Task::getpid()
@@ -249,39 +776,68 @@ int Task::sleep(pid_t pid, const Sigset &sig_wakeup)
 	uint32_t old_eflags;
 	CLI_SAVE_EFLAGS(old_eflags);
 
-	if (target->state == TS_RUNNING)
-	{
-		Task_t *next;
-		if (target == current_task)
-			next = get_next_task();
+	sleep_task(target, sig_wakeup);
 
-		Queue::running.remove(target);
-		Queue::sleeping.insert(target);
-		target->state = TS_SLEEPING;
-		target->sig_wakeup = sig_wakeup;
+	RESTORE_EFLAGS(old_eflags);
+	return 0;
+}
 
-		if (target == current_task)
-		{
-			// a task wants itself to sleep
+uint32_t Task::sleep_timeout(uint32_t nticks, const Sigset &sig_wakeup)
+{
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	Timer::Timer_t timer;
+	Timer::setup(timer, timeout_wakeup, current_task);
+	uint32_t expires = Timer::get_ticks() + nticks;
+	Timer::add(timer, expires);
+
+	sleep_task(current_task, sig_wakeup);
+
+	uint32_t left = 0;
+	if (Timer::cancel(timer))
+		left = max((int32_t)(expires - Timer::get_ticks()), 0);
 
-			uint32_t eip = read_eip();
-			if (eip == 0xFFFFFFFF) // on waking up
-			{
-				RESTORE_EFLAGS(old_eflags);
-				return 0;
-			}
-			asm volatile
-			(
-				"mov %%esp, %0\n"
-				"mov %%ebp, %1\n"
-				: "=g"(current_task->esp), "=g"(current_task->ebp)
-			);
-			current_task->eip = eip;
-			switch_task(next, old_eflags);
-		}
-	}
 	RESTORE_EFLAGS(old_eflags);
-	return 0;
+	return left;
+}
+
+void Task::wait(Wait_queue_t &wq, bool exclusive)
+{
+	Wait_entry_t entry;
+	entry.task = current_task;
+	entry.exclusive = exclusive;
+	wait_queue_insert(wq, &entry);
+
+	sleep_task(current_task, Sigset());
+
+	// still queued if woken up by other means
+	if (entry.queue)
+		wait_queue_remove(&entry);
+}
+
+uint32_t Task::wait_timeout(Wait_queue_t &wq, bool exclusive, uint32_t nticks)
+{
+	Timer::Timer_t timer;
+	Timer::setup(timer, timeout_wakeup, current_task);
+	uint32_t expires = Timer::get_ticks() + nticks;
+	Timer::add(timer, expires);
+
+	wait(wq, exclusive);
+
+	if (!Timer::cancel(timer))
+		return 0;
+	return max((int32_t)(expires - Timer::get_ticks()), 0);
+}
+
+void Task::wake_up_one(Wait_queue_t &wq)
+{
+	wake_up(wq, false);
+}
+
+void Task::wake_up_all(Wait_queue_t &wq)
+{
+	wake_up(wq, true);
 }
 
 int Task::wakeup(pid_t pid)
@@ -291,31 +847,129 @@ int Task::wakeup(pid_t pid)
 	uint32_t old_eflags;
 	CLI_SAVE_EFLAGS(old_eflags);
 
-	if (target->state == TS_SLEEPING)
-	{
-		Queue::sleeping.remove(target);
-		Queue::running.insert(target);
-		target->state = TS_RUNNING;
-	}
+	wake_task(target);
+
+	RESTORE_EFLAGS(old_eflags);
+
+	return 0;
+}
+
+int Task::set_nice(pid_t pid, int nice)
+{
+	Task_t *target = GET_TASK_BY_ID_NOZOMBIE(pid);
+	CHECK_PERM(target);
+	nice = max(min(nice, NICE_MAX), NICE_MIN);
+	if (nice < target->nice && !User::cap_test(current_task->uid, User::CAP_SYS_NICE))
+		ERROR_RETURN(EACCES);
+
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	sched->renice(target, nice);
+
+	// the priority of current task may have dropped below another one
+	Task_t *next = pick_next();
+	if (next != current_task && sched->preempt(next))
+		switch_to(current_task, next);
 
 	RESTORE_EFLAGS(old_eflags);
+	return 0;
+}
 
+int Task::get_nice(pid_t pid, int &nice)
+{
+	Task_t *target = GET_TASK_BY_ID(pid);
+	nice = target->nice;
 	return 0;
 }
 
+const char* Task::get_sched_name()
+{
+	return sched->get_name();
+}
+
 void Task::exit(int status)
+{
+	asm volatile ("cli");
+
+	Task_t *task = current_task;
+	kassert(task != idle_task);
+	task->exit_status = status;
+
+	orphan_children(task);
+
+	// free the address space while running on the directory of the idle
+	// task, which only has the kernel mappings; it has never been loaded,
+	// and enable() links the heap tables created since, including the one
+	// under the kernel stack we are running on
+	Page::Directory_t *dir = task->page_dir;
+	task->page_dir = idle_task->page_dir;
+	task->page_dir->enable();
+	if (task->vfork_borrowed)
+		task->vfork_borrowed = false; // the parent is woken up below
+	else
+		Page::free_directory(dir);
+
+	// the kernel stack is still in use, so it is freed when reaped
+	sched->dequeue(task);
+	task->state = TS_ZOMBIE;
+	if (task->par)
+		wake_up_locked(task->par->child_wait, true);
+	else
+		Queue::orphan.insert(task);
+
+	switch_to(task, pick_next());
+	panic("zombie task %d resumed", task->id);
+}
+
+pid_t Task::waitpid(pid_t pid, int &status)
 {
 	uint32_t old_eflags;
 	CLI_SAVE_EFLAGS(old_eflags);
-	status = old_eflags;
+
+	Task_t *task = current_task, *zombie;
+	for (; ;)
+	{
+		if (pid == (pid_t)-1)
+		{
+			if (!task->first_child)
+			{
+				RESTORE_EFLAGS(old_eflags);
+				ERROR_RETURN(ECHILD);
+			}
+			zombie = find_zombie(task);
+		}
+		else
+		{
+			Task_t *child = id2task(pid);
+			if (!child || child->par != task)
+			{
+				RESTORE_EFLAGS(old_eflags);
+				ERROR_RETURN(ECHILD);
+			}
+			zombie = child->state == TS_ZOMBIE ? child : NULL;
+		}
+		if (zombie)
+			break;
+		wait(task->child_wait, false);
+	}
+
+	pid_t ret = zombie->id;
+	status = zombie->exit_status;
+	reap(zombie);
+
+	RESTORE_EFLAGS(old_eflags);
+	return ret;
 }
 
-Task_t::Task_t(Page::Directory_t *dir) :
-	id(get_next_pid()), esp(0), ebp(0), eip(0),
-	page_dir(dir), state(TS_RUNNING), errno(0),
-	par(NULL), queue_next(NULL), queue_prev(NULL)
+Task_t::Task_t(pid_t id_, Page::Directory_t *dir) :
+	id(id_), esp(0), page_dir(dir), kstack(NULL),
+	state(TS_RUNNING), nice(0), prio(0), time_slice(0), sleep_avg(0), sleep_start(0),
+	array(NULL), vruntime(0), errno(0), kmem_alloc(0), kmem_free(0),
+	par(NULL), queue_next(NULL), queue_prev(NULL), spawn_info(NULL),
+	vfork_borrowed(false), thread_entry(NULL), thread_arg(NULL), exit_status(0),
+	first_child(NULL), sibling_next(NULL), sibling_prev(NULL)
 {
-	Task_t::latest_task = this;
 	Pair_id_task val;
 	val.id = this->id;
 	val.task = this;
@@ -324,6 +978,7 @@ Task_t::Task_t(Page::Directory_t *dir) :
 
 void Task_queue::insert(Task_t *task)
 {
+	// insert before ptr, i.e. at the end of the queue
 	if (!ptr)
 	{
 		ptr = task;
@@ -331,10 +986,10 @@ void Task_queue::insert(Task_t *task)
 	}
 	else
 	{
-		task->queue_next = ptr->queue_next;
-		task->queue_next->queue_prev = task;
-		ptr->queue_next = task;
-		task->queue_prev = ptr;
+		task->queue_prev = ptr->queue_prev;
+		task->queue_prev->queue_next = task;
+		ptr->queue_prev = task;
+		task->queue_next = ptr;
 	}
 }
 
@@ -354,6 +1009,51 @@ void Task_queue::remove(Task_t *task)
 	}
 }
 
+void Prio_array_t::insert(Task_t *task)
+{
+	int prio = task->prio;
+	queue[prio].insert(task);
+	bitmap[prio >> 5] |= 1u << (prio & 31);
+	nactive ++;
+	task->array = this;
+}
+
+void Prio_array_t::remove(Task_t *task)
+{
+	int prio = task->prio;
+	queue[prio].remove(task);
+	if (!queue[prio].ptr)
+		bitmap[prio >> 5] &= ~(1u << (prio & 31));
+	nactive --;
+	task->array = NULL;
+}
+
+Task_t* Prio_array_t::first() const
+{
+	for (int i = 0; i < PRIO_BITMAP_SIZE; i ++)
+		if (bitmap[i])
+			return queue[(i << 5) + bit_scan_forward(bitmap[i])].ptr;
+	return NULL;
+}
+
+void Task::account_kmem(uint32_t nbytes, bool freed)
+{
+	if (!current_task)
+		return;
+	if (freed)
+		current_task->kmem_free += nbytes;
+	else
+		current_task->kmem_alloc += nbytes;
+}
+
+int Task::get_kmem_stat(pid_t pid, uint32_t &nbytes_alloc, uint32_t &nbytes_free)
+{
+	Task_t *target = GET_TASK_BY_ID(pid);
+	nbytes_alloc = target->kmem_alloc;
+	nbytes_free = target->kmem_free;
+	return 0;
+}
+
 bool Task::is_kernel()
 {
 	return !switch_to_user_mode_called;
@@ -389,19 +1089,24 @@ void Task::switch_to_user_mode(uint32_t addr, uint32_t esp)
 
 pid_t get_next_pid()
 {
+	// at most one pass over all the pids
 	static pid_t next;
-	while (id2task(next))
-		next ++;
-	return next ++;
+	for (pid_t i = 0; i < PID_MAX; i ++)
+	{
+		pid_t pid = next;
+		next = (next + 1) % PID_MAX;
+		if (!id2task(pid))
+			return pid;
+	}
+	return (pid_t)-1;
 }
 
-void move_stack()
+void move_stack(uint32_t top)
 {
 	// we use static variables to avoid corruption
-	static uint32_t i, old_esp, old_ebp, 
+	static uint32_t i, old_esp, old_ebp, new_top,
 					offset, new_esp, new_ebp, tmp;
-
-	Page::current_page_dir->alloc_interval(KERNEL_STACK_POS - KERNEL_STACK_SIZE, KERNEL_STACK_POS, false, true);
+	new_top = top;
 
 	asm volatile
 	(
@@ -410,13 +1115,13 @@ void move_stack()
 		: "=g"(old_esp), "=g"(old_ebp)
 	);
 
-	offset = KERNEL_STACK_POS - initial_stack_pointer;
+	offset = new_top - initial_stack_pointer;
 	new_esp = old_esp + offset;
 	new_ebp = old_ebp + offset;
 
 	memcpy((void*)new_esp, (void*)old_esp, initial_stack_pointer - old_esp);
 
-	for (i = KERNEL_STACK_POS - 4; i > new_esp; i -= 4)
+	for (i = new_top - 4; i > new_esp; i -= 4)
 	{
 		tmp = *(uint32_t*)i;
 
@@ -433,39 +1138,432 @@ void move_stack()
 	);
 }
 
-void switch_task(Task_t *t, uint32_t old_eflags)
+void* kstack_alloc()
 {
-	current_task = t;
+	if (nstack_cached)
+		return stack_cache[-- nstack_cached];
+
+	// page faults can not be handled on a stack whose pages are not present
+	void *stack = kmalloc(KERNEL_STACK_SIZE, 12);
+	Page::current_page_dir->alloc_interval((uint32_t)stack,
+			(uint32_t)stack + KERNEL_STACK_SIZE, false, true);
+	return stack;
+}
 
-	uint32_t
-		esp = current_task->esp,
-		ebp = current_task->ebp,
-		eip = current_task->eip;
+void kstack_free(void *stack)
+{
+	if (nstack_cached < STACK_CACHE_SIZE)
+		stack_cache[nstack_cached ++] = stack;
+	else
+		kfree(stack);
+}
 
-	Page::current_page_dir = current_task->page_dir;
-	asm volatile
-	(
-		"movl %[old_eflags], %%ebx\n"
-		"movl %0, %%eax\n"
-		"movl %1, %%ecx\n"
-		"movl %2, %%esp\n"
-		"movl %3, %%cr3\n"
-		"movl %%eax, %%ebp\n" // IMPORTANT: ebp must be changed last
-		"movl $0xFFFFFFFF, %%eax\n"
-			// so after jump, we can replace the return value of read_eip() in schedule()
-		"pushl %%ebx\n"
-		"popf\n"
-		"jmp *%%ecx"
-		: : "g"(ebp), "g"(eip), "g"(esp), "g"(Page::current_page_dir->phyaddr), [old_eflags]"g"(old_eflags)
-		: "eax", "ebx", "ecx"
-	);
+void switch_to(Task_t *prev, Task_t *next)
+{
+	need_resched = false;
+	if (prev == next)
+		return;
+
+	if (prev == idle_task)
+		Timer::resume_tick();
+
+	current_task = next;
+	set_kernel_stack(kstack_top(next));
+
+	// the idle task only runs kernel code, so it just keeps the address space
+	// of the previous task
+	if (next != idle_task && next->page_dir != Page::current_page_dir)
+		next->page_dir->enable();
+
+	switch_context(&prev->esp, next->esp);
+}
+
+void Sched_prio::enqueue(Task_t *task, bool wakeup)
+{
+	if (wakeup)
+		task->sleep_avg = min(task->sleep_avg + (Timer::get_ticks() - task->sleep_start), MAX_SLEEP_AVG);
+	task->prio = effective_prio(task);
+	active->insert(task);
+}
+
+void Sched_prio::dequeue(Task_t *task)
+{
+	task->array->remove(task);
+	task->sleep_start = Timer::get_ticks();
+}
+
+Task_t* Sched_prio::pick_next()
+{
+	if (!active->nactive)
+	{
+		Prio_array_t *tmp = active;
+		active = expired;
+		expired = tmp;
+	}
+	return active->first();
+}
+
+bool Sched_prio::tick(Task_t *task)
+{
+	if (task->sleep_avg)
+		task->sleep_avg --;
+	if (-- task->time_slice)
+		return false;
+
+	task->time_slice = slice_ticks(task->nice);
+	active->remove(task);
+	task->prio = effective_prio(task);
+	expired->insert(task);
+	return true;
+}
+
+void Sched_prio::yield(Task_t *task)
+{
+	// let the other runnable tasks have their slices first
+	task->array->remove(task);
+	expired->insert(task);
+}
+
+bool Sched_prio::preempt(const Task_t *task)
+{
+	return task->prio < current_task->prio;
+}
+
+void Sched_prio::fork(Task_t *child)
+{
+	// split the remaining time slice, so that forking gains no CPU time
+	child->sleep_avg = current_task->sleep_avg;
+	uint32_t slice = current_task->time_slice;
+	child->time_slice = (slice + 1) >> 1;
+	current_task->time_slice = max(slice >> 1, 1u);
+}
+
+void Sched_prio::renice(Task_t *task, int nice)
+{
+	Prio_array_t *array = task->array;
+	if (array)
+		array->remove(task);
+	task->nice = nice;
+	task->prio = effective_prio(task);
+	task->time_slice = min(task->time_slice, slice_ticks(nice));
+	if (array)
+		array->insert(task);
+}
+
+void* Sched_fair::node_alloc()
+{
+	return fair_node_pool.get();
+}
+
+void Sched_fair::node_free(void *node)
+{
+	fair_node_pool.put(node);
+}
+
+Rbt_vrt_task::Node* Sched_fair::find(const Task_t *task)
+{
+	Pair_vrt_task key;
+	key.vruntime = task->vruntime;
+	key.task = const_cast<Task_t*>(task);
+	Rbt_vrt_task::Node *node = queue.find_ge(key);
+	kassert(node && node->get_key().task == task);
+	return node;
+}
+
+Task_t* Sched_fair::leftmost()
+{
+	Pair_vrt_task key;
+	key.vruntime = 0;
+	key.task = NULL;
+	Rbt_vrt_task::Node *node = queue.find_ge(key);
+	return node ? node->get_key().task : NULL;
+}
+
+void Sched_fair::insert(Task_t *task)
+{
+	Pair_vrt_task key;
+	key.vruntime = task->vruntime;
+	key.task = task;
+	queue.insert(key);
+}
+
+void Sched_fair::update_min_vruntime()
+{
+	Task_t *first = leftmost();
+	if (first && first->vruntime > min_vruntime)
+		min_vruntime = first->vruntime;
+}
+
+void Sched_fair::enqueue(Task_t *task, bool wakeup)
+{
+	if (wakeup && min_vruntime > FAIR_SLEEPER_CREDIT)
+		task->vruntime = max(task->vruntime, min_vruntime - FAIR_SLEEPER_CREDIT);
+	insert(task);
+	update_min_vruntime();
+}
+
+void Sched_fair::dequeue(Task_t *task)
+{
+	queue.erase(find(task));
+	update_min_vruntime();
+}
+
+Task_t* Sched_fair::pick_next()
+{
+	return leftmost();
+}
+
+bool Sched_fair::tick(Task_t *task)
+{
+	queue.erase(find(task));
+	task->vruntime += tick_vruntime(task->nice);
+	insert(task);
+	update_min_vruntime();
+
+	Task_t *first = leftmost();
+	return first != task && task->vruntime - first->vruntime > FAIR_GRANULARITY;
+}
+
+void Sched_fair::yield(Task_t *task)
+{
+	// move behind the rightmost task
+	Pair_vrt_task key;
+	key.vruntime = ~(uint64_t)0;
+	key.task = (Task_t*)~0u;
+	Task_t *last = queue.find_le(key)->get_key().task;
+	if (last == task)
+		return;
+	queue.erase(find(task));
+	task->vruntime = last->vruntime + 1;
+	insert(task);
+	update_min_vruntime();
+}
+
+bool Sched_fair::preempt(const Task_t *task)
+{
+	return task->vruntime + FAIR_GRANULARITY < current_task->vruntime;
+}
 
-	for (; ;); // this line should never be reached; just to emit gcc's warning
+void Sched_fair::fork(Task_t *child)
+{
+	// start a tick behind the parent, so that forking gains no CPU time
+	child->vruntime = max(current_task->vruntime, min_vruntime) + tick_vruntime(child->nice);
+}
+
+void Sched_fair::renice(Task_t *task, int nice)
+{
+	// the weight only affects virtual run time charged from now on
+	task->nice = nice;
+}
+
+Task_t* pick_next()
+{
+	Task_t *next = sched->pick_next();
+	return next ? next : idle_task;
+}
+
+void idle_main()
+{
+	for (; ;)
+	{
+		// use the idle time to prepare zero-filled frames
+		Page::refill_zeroed_pool();
+
+		asm volatile ("cli");
+		while (Queue::orphan.ptr)
+			reap(Queue::orphan.ptr);
+
+		Task_t *next = sched->pick_next();
+		if (next)
+			switch_to(idle_task, next);
+		else
+		{
+			// sleep until the next timer, or as long as the PIT can;
+			// interrupts are enabled right before hlt, so a wakeup can not be lost
+			Timer::stop_tick(Timer::next_expiry(Timer::MAX_ONESHOT_TICKS + 1));
+			asm volatile ("sti; hlt; cli");
+			Timer::resume_tick();
+		}
+		asm volatile ("sti");
+	}
+}
+
+void sleep_task(Task_t *task, const Sigset &sig_wakeup)
+{
+	if (task->state != TS_RUNNING)
+		return;
+
+	sched->dequeue(task);
+	Queue::sleeping.insert(task);
+	task->state = TS_SLEEPING;
+	task->sig_wakeup = sig_wakeup;
+
+	if (task == current_task)
+		switch_to(task, pick_next()); // a task wants itself to sleep
+}
+
+void wake_task(Task_t *task)
+{
+	if (make_runnable(task))
+		switch_to(current_task, pick_next());
+}
+
+bool make_runnable(Task_t *task)
+{
+	if (task->state != TS_SLEEPING)
+		return false;
+
+	Queue::sleeping.remove(task);
+	task->state = TS_RUNNING;
+	sched->enqueue(task, true);
+
+	// preempt current task if a more important one becomes runnable
+	if (current_task == idle_task || sched->preempt(task))
+		need_resched = true;
+	return need_resched;
+}
+
+void wait_queue_insert(Wait_queue_t &wq, Wait_entry_t *entry)
+{
+	entry->queue = &wq;
+	if (entry->exclusive)
+	{
+		entry->next = NULL;
+		entry->prev = wq.tail;
+		if (wq.tail)
+			wq.tail->next = entry;
+		else
+			wq.head = entry;
+		wq.tail = entry;
+	}
+	else
+	{
+		entry->prev = NULL;
+		entry->next = wq.head;
+		if (wq.head)
+			wq.head->prev = entry;
+		else
+			wq.tail = entry;
+		wq.head = entry;
+	}
+}
+
+void wait_queue_remove(Wait_entry_t *entry)
+{
+	Wait_queue_t &wq = *entry->queue;
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		wq.head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		wq.tail = entry->prev;
+	entry->queue = NULL;
+}
+
+void wake_up(Wait_queue_t &wq, bool all)
+{
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	if (wake_up_locked(wq, all))
+		switch_to(current_task, pick_next());
+
+	RESTORE_EFLAGS(old_eflags);
+}
+
+bool wake_up_locked(Wait_queue_t &wq, bool all)
+{
+	// do not switch in the middle, since the entries are on the stacks of the waiters
+	bool resched = false;
+	Wait_entry_t *entry;
+	while ((entry = wq.head))
+	{
+		bool exclusive = entry->exclusive;
+		wait_queue_remove(entry);
+		if (make_runnable(static_cast<Task_t*>(entry->task)))
+			resched = true;
+		if (exclusive && !all)
+			break;
+	}
+	return resched;
+}
+
+void timeout_wakeup(void *task)
+{
+	// the task switch is left to Task::tick(), after all due timers have run
+	make_runnable(static_cast<Task_t*>(task));
 }
 
-Task_t* get_next_task()
+void init_context(Task_t *task, void (*entry)())
 {
-	return current_task->queue_next;
+	// start on an empty kernel stack: the context restored by switch_context
+	// is all zero except for the return address, above which is a dummy
+	// return address of @entry
+	uint32_t *stack = (uint32_t*)kstack_top(task) - 6;
+	memset(stack, 0, sizeof(uint32_t) * 6);
+	stack[4] = (uint32_t)entry;
+	task->esp = (uint32_t)stack;
+}
+
+uint32_t slice_ticks(int nice)
+{
+	// 100ms for nice 0, 200ms for NICE_MIN
+	return max((uint32_t)(NICE_MAX + 1 - nice) * KERNEL_HZ / 200, 1u);
+}
+
+int effective_prio(const Task_t *task)
+{
+	int bonus = (int)(task->sleep_avg * MAX_BONUS / MAX_SLEEP_AVG);
+	return max(task->nice - NICE_MIN - bonus, 0);
+}
+
+uint32_t tick_vruntime(int nice)
+{
+	// the weights differ by about 1.25 times between adjacent nice values
+	static const uint32_t weight[NPRIO] =
+	{
+		/* -20 */	88761,	71755,	56483,	46273,	36291,
+		/* -15 */	29154,	23254,	18705,	14949,	11916,
+		/* -10 */	9548,	7620,	6100,	4904,	3906,
+		/*  -5 */	3121,	2501,	1991,	1586,	1277,
+		/*   0 */	1024,	820,	655,	526,	423,
+		/*   5 */	335,	272,	215,	172,	137,
+		/*  10 */	110,	87,		70,		56,		45,
+		/*  15 */	36,		29,		23,		18,		15
+	};
+	return TICK_VRUNTIME * NICE_0_WEIGHT / weight[nice - NICE_MIN];
+}
+
+void sched_fork(Task_t *child)
+{
+	child->nice = current_task->nice;
+	sched->fork(child);
+	sched->enqueue(child, false);
+}
+
+bool cmdline_has(const char *cmdline, const char *opt)
+{
+	uint32_t len = strlen(opt);
+	while (*cmdline)
+	{
+		while (*cmdline == ' ')
+			cmdline ++;
+		const char *end = cmdline;
+		while (*end && *end != ' ')
+			end ++;
+		if ((uint32_t)(end - cmdline) == len)
+		{
+			uint32_t i = 0;
+			while (i < len && cmdline[i] == opt[i])
+				i ++;
+			if (i == len)
+				return true;
+		}
+		cmdline = end;
+	}
+	return false;
 }
 
 void set_errno(int errno)
@@ -478,7 +1576,7 @@ Task_t* id2task(pid_t pid)
 	Pair_id_task req;
 	req.id = pid;
 	Rbt_id_task::Node *ptr = rbt_id2task.find_ge(req);
-	if (ptr)
+	if (ptr && ptr->get_key().id == pid)
 		return ptr->get_key().task;
 	return NULL;
 }
@@ -486,11 +1584,106 @@ Task_t* id2task(pid_t pid)
 
 void *Task_t::rbt_alloc()
 {
-	uint32_t addr = (uint32_t)Task_t::latest_task->rbt_node_mem;
-	return (void*)(addr + (addr & 1));
+	return id_node_pool.get();
+}
+
+void Task_t::rbt_free(void *node)
+{
+	id_node_pool.put(node);
+}
+
+void* Task_t::operator new(size_t size)
+{
+	kassert(size == sizeof(Task_t));
+	Task_t *task = task_cache;
+	if (task)
+	{
+		task_cache = *reinterpret_cast<Task_t**>(task);
+		return task;
+	}
+
+	task = static_cast<Task_t*>(kmalloc(size));
+	uint32_t addr = (uint32_t)task->rbt_node_mem;
+	id_node_pool.put((void*)(addr + (addr & 1)));
+	addr = (uint32_t)task->fair_node_mem;
+	fair_node_pool.put((void*)(addr + (addr & 1)));
+	return task;
 }
 
-void Task_t::rbt_free(void *)
+void Task_t::operator delete(void *ptr)
 {
+	*static_cast<Task_t**>(ptr) = task_cache;
+	task_cache = static_cast<Task_t*>(ptr);
+}
+
+void* Node_pool_t::get()
+{
+	void *node = head;
+	kassert(node);
+	head = *static_cast<void**>(node);
+	return node;
+}
+
+void Node_pool_t::put(void *node)
+{
+	*static_cast<void**>(node) = head;
+	head = node;
+}
+
+void reap(Task_t *task)
+{
+	kassert(task->state == TS_ZOMBIE);
+	if (task->par)
+		unlink_child(task);
+	else
+		Queue::orphan.remove(task);
+
+	Pair_id_task key;
+	key.id = task->id;
+	rbt_id2task.erase(rbt_id2task.find_ge(key));
+
+	kstack_free(task->kstack);
+	delete task;
+}
+
+Task_t* find_zombie(const Task_t *par)
+{
+	for (Task_t *task = par->first_child; task; task = task->sibling_next)
+		if (task->state == TS_ZOMBIE)
+			return task;
+	return NULL;
+}
+
+void link_child(Task_t *child)
+{
+	Task_t *par = child->par;
+	child->sibling_prev = NULL;
+	child->sibling_next = par->first_child;
+	if (par->first_child)
+		par->first_child->sibling_prev = child;
+	par->first_child = child;
+}
+
+void unlink_child(Task_t *child)
+{
+	if (child->sibling_prev)
+		child->sibling_prev->sibling_next = child->sibling_next;
+	else
+		child->par->first_child = child->sibling_next;
+	if (child->sibling_next)
+		child->sibling_next->sibling_prev = child->sibling_prev;
+	child->sibling_next = child->sibling_prev = NULL;
+}
+
+void orphan_children(Task_t *task)
+{
+	while (task->first_child)
+	{
+		Task_t *child = task->first_child;
+		unlink_child(child);
+		child->par = NULL;
+		if (child->state == TS_ZOMBIE)
+			Queue::orphan.insert(child);
+	}
 }
 
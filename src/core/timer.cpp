@@ -0,0 +1,291 @@
+/*
+ * $File: timer.cpp
+ * $Date: Sun Oct 18 10:09:04 2026 +0800
+ *
+ * the system timer (PIT channel 0)
+ */
+/*
+This file is part of JKOS
+
+Copyright (C) <2010>  Jiakai <jia.kai66@gmail.com>
+
+JKOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JKOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <timer.h>
+#include <port.h>
+#include <descriptor_table.h>
+#include <task.h>
+
+using namespace Timer;
+
+static const uint8_t
+	PIT_CHANNEL0 = 0x40,
+	PIT_COMMAND = 0x43,
+
+	// channel 0, access lobyte/hibyte
+	PIT_MODE_PERIODIC = 0b00110110, // square wave generator
+	PIT_MODE_ONESHOT = 0b00110000, // interrupt on terminal count
+	PIT_READ_BACK = 0b11000010, // latch both status and count of channel 0
+	PIT_STATUS_OUT = 0x80; // state of the OUT pin, set after terminal count in one-shot mode
+
+static volatile uint32_t ticks;
+
+static const uint32_t
+	TVR_BITS = 8, TVN_BITS = 6, NTVN = 4,
+	TVR_SIZE = 1 << TVR_BITS, TVN_SIZE = 1 << TVN_BITS,
+	TVR_MASK = TVR_SIZE - 1, TVN_MASK = TVN_SIZE - 1;
+
+// the timing wheel: the first level and the higher levels
+static Timer_t *tv1[TVR_SIZE], *tvn[NTVN][TVN_SIZE];
+static uint32_t timer_ticks; // the tick whose timers are to be run next
+
+// put @timer into the slot of the wheel according to its expiring time
+static void wheel_insert(Timer_t *timer);
+static void wheel_remove(Timer_t *timer);
+
+// move the timers in slot @idx of level @level (starting at 0 for tvn[0])
+// to the lower levels; return @idx
+static uint32_t cascade(uint32_t level, uint32_t idx);
+
+// run the timers due up to current tick
+static void run_timers();
+static bool tick_stopped;
+static uint32_t oneshot_cycles, // PIT cycles programmed when the tick was stopped
+				residue_cycles; // PIT cycles elapsed but not yet accounted as a tick
+
+static void pit_program(uint8_t mode, uint32_t cycles);
+
+// get the current count of PIT channel 0 in @count,
+// and return whether its OUT pin is high
+static bool pit_read(uint32_t &count);
+
+// account @cycles PIT cycles elapsed while the tick was stopped
+static void account_cycles(uint32_t cycles);
+
+static void timer_isr(Isr_registers_t reg);
+
+
+void Timer::init()
+{
+	isr_register(ISR_GET_NUM_BY_IRQ(0), timer_isr);
+	pit_program(PIT_MODE_PERIODIC, TICK_CYCLES);
+}
+
+uint32_t Timer::get_ticks()
+{
+	return ticks;
+}
+
+void Timer::setup(Timer_t &timer, Timer_t::Callback_t callback, void *arg)
+{
+	timer.callback = callback;
+	timer.arg = arg;
+	timer.expires = 0;
+	timer.period = 0;
+	timer.slot = NULL;
+	timer.next = timer.prev = NULL;
+}
+
+void Timer::add(Timer_t &timer, uint32_t expires)
+{
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	if (timer.slot)
+		wheel_remove(&timer);
+	timer.expires = expires;
+	wheel_insert(&timer);
+
+	RESTORE_EFLAGS(old_eflags);
+}
+
+bool Timer::cancel(Timer_t &timer)
+{
+	uint32_t old_eflags;
+	CLI_SAVE_EFLAGS(old_eflags);
+
+	bool pending = timer.slot != NULL;
+	if (pending)
+		wheel_remove(&timer);
+
+	RESTORE_EFLAGS(old_eflags);
+	return pending;
+}
+
+uint32_t Timer::next_expiry(uint32_t limit)
+{
+	// timers due within the look-ahead are all in the first level, unless it
+	// wraps around, where the cascading may bring in more
+	if ((int32_t)(timer_ticks - ticks) <= 0)
+		return 0; // some ticks are not processed yet
+	for (uint32_t t = timer_ticks; t - ticks < limit; t ++)
+		if (tv1[t & TVR_MASK] || !(t & TVR_MASK))
+			return t - ticks;
+	return limit;
+}
+
+void Timer::stop_tick(uint32_t nticks)
+{
+	uint32_t cycles = MAX_ONESHOT_CYCLES;
+	if (nticks <= MAX_ONESHOT_TICKS)
+		cycles = max(nticks, 1u) * TICK_CYCLES;
+
+	tick_stopped = true;
+	oneshot_cycles = cycles;
+	pit_program(PIT_MODE_ONESHOT, cycles);
+}
+
+void Timer::resume_tick()
+{
+	if (!tick_stopped)
+		return;
+
+	// after reaching zero the counter wraps around and keeps counting down
+	// from 0xFFFF, so only the OUT pin tells whether it has fired; the
+	// interrupt is then pending and will be counted as a periodic tick, so
+	// one tick of the one-shot period is left to it
+	uint32_t remain;
+	if (!pit_read(remain))
+		account_cycles(oneshot_cycles - remain);
+	else
+		account_cycles(oneshot_cycles - TICK_CYCLES + ((0x10000 - remain) & 0xFFFF));
+	tick_stopped = false;
+	pit_program(PIT_MODE_PERIODIC, TICK_CYCLES);
+}
+
+void pit_program(uint8_t mode, uint32_t cycles)
+{
+	using namespace Port;
+	outb(PIT_COMMAND, mode);
+	wait();
+	outb(PIT_CHANNEL0, (uint8_t)(cycles & 0xFF));
+	wait();
+	outb(PIT_CHANNEL0, (uint8_t)((cycles >> 8) & 0xFF));
+}
+
+bool pit_read(uint32_t &count)
+{
+	using namespace Port;
+	// status and count are latched together, so they agree with each other
+	outb(PIT_COMMAND, PIT_READ_BACK);
+	uint8_t status = inb(PIT_CHANNEL0);
+	uint32_t low = inb(PIT_CHANNEL0);
+	count = low | ((uint32_t)inb(PIT_CHANNEL0) << 8);
+	return status & PIT_STATUS_OUT;
+}
+
+void wheel_insert(Timer_t *timer)
+{
+	uint32_t expires = timer->expires,
+			 delta = expires - timer_ticks;
+	Timer_t **slot;
+	if ((int32_t)delta < 0)
+		slot = &tv1[timer_ticks & TVR_MASK]; // already passed
+	else if (delta < TVR_SIZE)
+		slot = &tv1[expires & TVR_MASK];
+	else
+	{
+		uint32_t level = 0;
+		while (level < NTVN - 1 && delta >= (1u << (TVR_BITS + (level + 1) * TVN_BITS)))
+			level ++;
+		slot = &tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+	}
+
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = *slot;
+	if (*slot)
+		(*slot)->prev = timer;
+	*slot = timer;
+}
+
+void wheel_remove(Timer_t *timer)
+{
+	if (timer->prev)
+		timer->prev->next = timer->next;
+	else
+		*timer->slot = timer->next;
+	if (timer->next)
+		timer->next->prev = timer->prev;
+	timer->slot = NULL;
+	timer->next = timer->prev = NULL;
+}
+
+uint32_t cascade(uint32_t level, uint32_t idx)
+{
+	Timer_t *timer = tvn[level][idx];
+	tvn[level][idx] = NULL;
+	while (timer)
+	{
+		Timer_t *next = timer->next;
+		wheel_insert(timer);
+		timer = next;
+	}
+	return idx;
+}
+
+void run_timers()
+{
+	while ((int32_t)(ticks - timer_ticks) >= 0)
+	{
+		uint32_t idx = timer_ticks & TVR_MASK;
+		if (!idx)
+		{
+			// the first level wraps around; refill it from the higher levels
+			for (uint32_t level = 0; level < NTVN; level ++)
+				if (cascade(level, (timer_ticks >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK))
+					break;
+		}
+		timer_ticks ++;
+
+		// the callbacks may add or cancel timers, so take one at a time
+		Timer_t *timer;
+		while ((timer = tv1[idx]))
+		{
+			wheel_remove(timer);
+			timer->callback(timer->arg);
+			if (timer->period && !timer->slot)
+			{
+				timer->expires += timer->period;
+				wheel_insert(timer);
+			}
+		}
+	}
+}
+
+void account_cycles(uint32_t cycles)
+{
+	residue_cycles += cycles;
+	ticks += residue_cycles / TICK_CYCLES;
+	residue_cycles %= TICK_CYCLES;
+}
+
+void timer_isr(Isr_registers_t reg)
+{
+	if (tick_stopped)
+	{
+		// the one-shot interrupt
+		account_cycles(oneshot_cycles);
+		tick_stopped = false;
+		pit_program(PIT_MODE_PERIODIC, TICK_CYCLES);
+	}
+	else
+		ticks ++;
+
+	isr_eoi(reg.int_no);
+	run_timers();
+	Task::tick();
+}
+
@@ -1,6 +1,6 @@
 /*
  * $File: ramdisk.cpp
- * $Date: Sun Dec 26 19:37:14 2010 +0800
+ * $Date: Sun Oct 18 09:50:00 2026 +0800
  *
  * RAM disk
  */
@@ -143,3 +143,43 @@ Node_file* ramdisk_get_file_node(uint32_t start, uint32_t end)
 	return new Ramdisk_file_node(start, end);
 }
 
+struct Module_t
+{
+	const char *name;
+	uint32_t start, end;
+};
+
+static Module_t *modules;
+static uint32_t nmodule;
+
+void ramdisk_init(Multiboot_info_t *mbd)
+{
+	if (!(mbd->flags & MULTIBOOT_INFO_MODS) || !mbd->mods_count)
+		return;
+
+	// the command lines are copied to static memory by Page::init
+	nmodule = mbd->mods_count;
+	modules = new Module_t[nmodule];
+	for (uint32_t i = 0; i < nmodule; i ++)
+	{
+		const Multiboot_mod_list *mod = (const Multiboot_mod_list*)mbd->mods_addr + i;
+		modules[i].name = mod->cmdline ? (const char*)mod->cmdline : "";
+		modules[i].start = mod->mod_start;
+		modules[i].end = mod->mod_end;
+	}
+}
+
+Node_file* ramdisk_open(const char *name)
+{
+	for (uint32_t i = 0; i < nmodule; i ++)
+	{
+		const char *base = modules[i].name;
+		for (const char *p = base; *p; p ++)
+			if (*p == '/')
+				base = p + 1;
+		if (!strcmp(modules[i].name, name) || !strcmp(base, name))
+			return new Ramdisk_file_node(modules[i].start, modules[i].end);
+	}
+	return NULL;
+}
+
@@ -1,6 +1,6 @@
 /*
  * $File: asm.h
- * $Date: Wed Dec 29 19:49:33 2010 +0800
+ * $Date: Sun Oct 18 10:07:11 2026 +0800
  *
  * definitions for asm functions
  */
@@ -33,7 +33,11 @@ along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
 
 #define TSS_DESCRIPTOR_SELECTOR	0x28
 
-#define NR_SYSCALLS				5
+#define NR_SYSCALLS				15
+
+// bytes on top of the kernel stack in a system call from user mode:
+// the iret frame and the registers saved by isr0x80
+#define SYSCALL_FRAME_SIZE		(4 * 12)
 
 #endif // _HEADER_ASM_
 
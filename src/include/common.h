@@ -1,6 +1,6 @@
 /*
  * $File: common.h
- * $Date: Wed Dec 29 20:16:53 2010 +0800
+ * $Date: Sun Oct 18 10:12:21 2026 +0800
  *
  * some common definitions and functions
  */
@@ -90,6 +90,22 @@ static inline const T& min(const T &a, const T &b)
 static inline uint32_t get_aligned(uint32_t addr, int palign)
 { if (!addr) return 0; return (((addr - 1) >> palign) + 1) << palign; }
 
+// read the time-stamp counter (number of CPU cycles since reset)
+static inline uint64_t read_tsc()
+{ uint64_t ret; asm volatile ("rdtsc" : "=A"(ret)); return ret; }
+
+// get the index of the lowest set bit of @val, which must not be 0
+static inline int bit_scan_forward(uint32_t val)
+{ int ret; asm ("bsf %1, %0" : "=r"(ret) : "rm"(val)); return ret; }
+
+// get the feature flags returned in edx by CPUID with eax = 1 (see CPUID_* below)
+static inline uint32_t cpuid_features()
+{
+	uint32_t eax = 1, edx;
+	asm volatile ("cpuid" : "+a"(eax), "=d"(edx) : : "ebx", "ecx");
+	return edx;
+}
+
 
 
 // constants
@@ -97,14 +113,22 @@ static const uint32_t
 	CLOCK_TICK_RATE	=	1193180,
 	KERNEL_HZ		=	50,
 
-	// KERNEL_STACK_POS must be page (4kb) aligned, and KERNEL_STACK_SIZE must be a multiple of 4kb
-	KERNEL_STACK_POS	= 0xFFFFF000, // beginning (highest) address of kernel stack plus 1
+	// size of the kernel stack of every task, allocated in kernel heap;
+	// must be a multiple of 4kb
 	KERNEL_STACK_SIZE	= 4 * 1024,
 
 	// KERNEL_HEAP_END must lie on page directry (4mb) boundary,
-	// and only kernel stack should be above kernel heap
-	KERNEL_HEAP_END		= (KERNEL_STACK_POS - KERNEL_STACK_SIZE) & 0xFFC00000,
-	KERNEL_HEAP_BEGIN	= KERNEL_HEAP_END - 256 * 1024 * 1024;
+	// and nothing is mapped above kernel heap
+	KERNEL_HEAP_END		= 0xFFC00000,
+	KERNEL_HEAP_BEGIN	= KERNEL_HEAP_END - 256 * 1024 * 1024,
+
+	// the first PHYSMAP_SIZE bytes of physical memory are mapped right below kernel heap
+	PHYSMAP_SIZE		= 256 * 1024 * 1024,
+	PHYSMAP_BEGIN		= KERNEL_HEAP_BEGIN - PHYSMAP_SIZE,
+
+	// feature flags returned by cpuid_features()
+	CPUID_PSE			= 1 << 3,	// 4mb pages
+	CPUID_PGE			= 1 << 13;	// global pages
 
 
 // global variables
@@ -1,6 +1,6 @@
 /*
  * $File: descriptor_table.h
- * $Date: Tue Dec 21 11:36:27 2010 +0800
+ * $Date: Sun Oct 18 09:19:04 2026 +0800
  *
  * descriptor table structures
  *
@@ -98,5 +98,8 @@ extern void isr_eoi(int int_no);
  */
 extern void init_descriptor_tables();
 
+// set the stack pointer loaded on entering kernel mode from user mode
+extern void set_kernel_stack(uint32_t esp0);
+
 #endif
 
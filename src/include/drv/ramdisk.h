@@ -1,6 +1,6 @@
 /*
  * $File: ramdisk.h
- * $Date: Tue Dec 14 17:35:45 2010 +0800
+ * $Date: Sun Oct 18 09:17:35 2026 +0800
  *
  * RAM disk
  */
@@ -28,9 +28,19 @@ along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <fs/base.h>
 #include <common.h>
+#include <multiboot.h>
 
 // get a ramdisk file in the momory address [start, end)
 // the node is created by new operator and should be freed by delete
 Fs::Node_file* ramdisk_get_file_node(uint32_t start, uint32_t end);
 
+// remember the modules loaded by the boot loader, so they can be opened by name
+// must be called after paging is initialized
+void ramdisk_init(Multiboot_info_t *mbd);
+
+// open the module whose command line, or its last path component, is @name
+// return NULL if no such module exists
+// the node is created by new operator and should be freed by delete
+Fs::Node_file* ramdisk_open(const char *name);
+
 #endif
@@ -1,6 +1,6 @@
 /*
  * $File: kheap.h
- * $Date: Wed Dec 29 20:17:07 2010 +0800
+ * $Date: Sun Oct 18 09:05:18 2026 +0800
  *
  * manipulate kernel heap (virtual memory)
  */
@@ -34,11 +34,23 @@ along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
  * @palign: the returned address will be aligned on 2^@palign byte boundries
  *
  * Note: before calling kheap_finish_init, the memory will be allocated in static kernel heap
+ * Note: small requests are served by slab caches (see slab.h)
  */
 extern void* kmalloc(uint32_t size, int palign = 0);
 
+// same as kmalloc, but account the allocation to call site @caller
+// (used by wrappers like operator new)
+extern void* kmalloc_at(uint32_t size, int palign, void *caller);
+
 extern void kfree(void *ptr);
 
+/*
+ * allocate/free a block directly from the heap, bypassing slab caches and
+ * statistics (used by the allocators built on top of the heap)
+ */
+extern void* kheap_alloc_block(uint32_t size, int palign);
+extern void kheap_free_block(void *ptr);
+
 /*
  * initialize kernel heap (should only be called by Page::init())
  */
@@ -52,6 +64,46 @@ extern void kheap_preserve_mem(uint32_t addr);
  */
 extern uint32_t kheap_get_size_pre_init(); 
 
+/*
+ * get the maximal number of nodes ever used at the same time by the
+ * unallocated block index (i.e. the high-water mark of heap fragmentation)
+ */
+extern uint32_t kheap_get_node_high_water();
+
+/*
+ * give back at most @npage frames of freed heap pages to the frame
+ * allocator (pages are kept after kfree to make reallocation cheap)
+ * return the number of frames released
+ */
+extern uint32_t kheap_reclaim(uint32_t npage);
+
+struct Kheap_stat_t
+{
+	uint32_t
+		nalloc, nfree,		// number of calls to kmalloc and kfree
+		nbytes_alloc,		// bytes currently allocated (slab objects count as their class size)
+		nbytes_free,		// total size of unallocated blocks
+		largest_free,		// size of the largest unallocated block
+		nfree_block,		// number of unallocated blocks
+		node_high_water,	// see kheap_get_node_high_water()
+		nsite_lost,			// number of allocations not accounted to any call site
+		nwarm_page,			// number of freed pages whose frames are still kept
+		nwarm_reuse,		// number of times a kept page was allocated again
+		task_nbytes_alloc,	// bytes ever allocated by a task (filled by the syscall)
+		task_nbytes_free;	// bytes ever freed by a task (filled by the syscall)
+};
+
+struct Kheap_site_stat_t
+{
+	uint32_t caller,	// return address of the call to kmalloc
+			 nalloc, nbytes;
+};
+
+extern void kheap_get_stat(Kheap_stat_t &stat);
+
+// copy at most @nbuf call site statistics to @buf, return the number copied
+extern int kheap_get_site_stat(Kheap_site_stat_t *buf, int nbuf);
+
 
 #ifdef _DEBUG_BUILD_
 extern void kheap_output_debug_msg();
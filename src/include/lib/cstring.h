@@ -1,6 +1,6 @@
 /*
  * $File: cstring.h
- * $Date: Wed Dec 29 19:34:59 2010 +0800
+ * $Date: Sun Oct 18 09:17:35 2026 +0800
  *
  * functions for manipulating C-style strings
  */
@@ -31,6 +31,8 @@ along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
 extern void memset(void *dest, int val, size_t cnt);
 extern void memcpy(void *dest, const void *src, size_t cnt);
 extern char* strcpy(char *dest, const char *src);
+extern size_t strlen(const char *str);
+extern int strcmp(const char *s1, const char *s2);
 
 #endif // _HEADER_CSTRING_
 
@@ -1,6 +1,6 @@
 /*
  * $File: page.h
- * $Date: Tue Dec 28 15:53:51 2010 +0800
+ * $Date: Sun Oct 18 10:09:21 2026 +0800
  *
  * x86 virtual memory management by paging
  */
@@ -39,8 +39,14 @@ namespace Page
 		// write-back enabled otherwise
 		uint32_t cache_dis	: 1;	// this page will not cached iff it is set
 		uint32_t accessed	: 1;	// whether this page has been read or written to
-		uint32_t zero		: 6;	// set size to 4kb; other fields not used
-		uint32_t addr		: 20;	// page table 4kb aligned physical address
+		uint32_t dirty		: 1;	// whether this page has been written to (4mb page only)
+		uint32_t large		: 1;	// if set, this entry maps a 4mb page instead of a table
+		uint32_t global		: 1;	// same as the one in Table_entry_t (4mb page only)
+		uint32_t shared		: 1;	// the table is shared copy-on-write with other directories,
+									// so rw is cleared until it is copied
+		uint32_t avail		: 2;
+		uint32_t addr		: 20;	// page table 4kb aligned physical address,
+									// or 4mb aligned physical address of the large page
 	} __attribute__((packed));
 
 	struct Table_entry_t
@@ -59,13 +65,15 @@ namespace Page
 									// Note, that the page global enable bit in
 									// CR4 must be set to enable this feature. 
 		uint32_t allocable	: 1;	// this page can be allocated iff this field is not zero (used to detect page fault)
-		uint32_t alloc_fill	: 2;	// whether this page will be filled with zero on allocation in page fault
+		uint32_t alloc_fill	: 1;	// whether this page will be filled with zero on allocation in page fault
+		uint32_t zero_rw	: 1;	// the rw bit to restore when this page is mapped to the shared
+									// zero frame (which is read-only) and gets written to
 		uint32_t addr		: 20;	// physical page frame address
 
 
-		// allocate a frame for this page
+		// allocate a frame for this page, filled with zero if @fill_zero is true
 		// if a frame is already allocated, only the rw and user permission bits will be set
-		void alloc(bool user, bool writable);
+		void alloc(bool user, bool writable, bool fill_zero = false);
 
 		// mark this page as allocable, but do not allocate physical memory now
 		// if a frame is already allocated:
@@ -96,6 +104,18 @@ namespace Page
 		Table_entry_t pages[1024];
 	};
 
+	/*
+	 * Page tables of the kernel heap are created on demand and shared by all
+	 * page directories. Except the first one (created in kheap_init), they are
+	 * placed at the beginning of the heap area, so creating one only needs a
+	 * frame; page directories pick them up in get_page() or on page fault.
+	 * If PSE is available and memory is plentiful, other parts of the heap
+	 * filled by a single block are mapped by 4mb pages instead of tables.
+	 */
+	static const uint32_t
+		HEAP_NTABLE = (KERNEL_HEAP_END - KERNEL_HEAP_BEGIN) >> 22,
+		HEAP_TABLE_AREA_END = KERNEL_HEAP_BEGIN + (HEAP_NTABLE - 1) * 0x1000;
+
 	struct Directory_t
 	{
 		// array of pointers to page tables
@@ -107,11 +127,16 @@ namespace Page
 		// physical address of entries
 		uint32_t phyaddr;
 
+		// number of kernel heap tables known to be linked here, see enable()
+		uint32_t nheap_linked;
 
 		// get the page containing virtual address @addr in this page directory
 		// if the corresponding table does not exist:
 		//		if @make is true, a new table will be allocated
 		//		otherwise NULL is returned
+		// if @addr is mapped by a 4mb page, NULL is returned
+		// if the table is shared copy-on-write, this directory gets its own copy first
+		// (kernel heap tables created by other directories are linked here)
 		Table_entry_t *get_page(uint32_t addr, bool make = false);
 
 		// lazy allocation on the interval [@start, @end)
@@ -126,6 +151,8 @@ namespace Page
 		void free_interval(uint32_t begin, uint32_t end);
 
 		// load this page directory into the CR3 register
+		// kernel heap tables not linked yet are linked first, since the
+		// kernel stacks are in the heap and a fault on them can not be handled
 		void enable();
 
 		// get physical address of virtual address @addr
@@ -142,12 +169,50 @@ namespace Page
 	 */
 	extern void init(void *ptr_mbd);
 
+	// maximal order of blocks returned by alloc_frames (2^10 frames = 4mb)
+	static const uint32_t MAX_ORDER = 10;
+
+	/*
+	 * allocate 2^@order physically contiguous frames, aligned on 2^@order frames
+	 * return the physical address of the first frame, or 0 if out of memory
+	 *
+	 * Note: the reference count of each frame is set to 1, so the frames can be
+	 * mapped and freed separately
+	 */
+	extern uint32_t alloc_frames(int order);
+
+	// free the frames allocated by alloc_frames
+	extern void free_frames(uint32_t phyaddr, int order);
+
+	// get the number of free frames
+	extern uint32_t get_nfree_frames();
+
+	/*
+	 * fill the pool of zero-filled frames (used by zero-fill page faults)
+	 * this is called by the idle task, with interrupts enabled between frames
+	 */
+	extern void refill_zeroed_pool();
+
+	// get the number of frames in the zero-filled pool, and the number of
+	// zero-filled frames allocated from (@nhit) or without (@nmiss) the pool
+	extern void get_zeroed_pool_stat(uint32_t &nfree, uint32_t &nhit, uint32_t &nmiss);
+
+	// create a page directory with only the kernel mappings
+	extern Directory_t *new_directory();
+
 	/*
 	 * copy a page directory:
 	 *		link the kernel tables
-	 *		copy other frames (mark as ro, copy-on-write)
+	 *		share other tables copy-on-write (mark as ro in both directories)
+	 */
+	extern Directory_t *clone_directory(Directory_t *src);
+
+	/*
+	 * free a page directory and all the user memory mapped only by it;
+	 * tables shared with other directories are left to them
+	 * @dir must not be the current page directory
 	 */
-	extern Directory_t *clone_directory(const Directory_t *src);
+	extern void free_directory(Directory_t *dir);
 
 	// invalidate the TLB entry for page containing memory address @addr
 	static inline void invlpg(uint32_t addr)
@@ -0,0 +1,87 @@
+/*
+ * $File: slab.h
+ * $Date: Sun Oct 18 09:02:03 2026 +0800
+ *
+ * slab caches for small kernel objects
+ */
+/*
+This file is part of JKOS
+
+Copyright (C) <2010>  Jiakai <jia.kai66@gmail.com>
+
+JKOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JKOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HEADER_SLAB_
+#define _HEADER_SLAB_
+
+#include <common.h>
+
+/*
+ * Objects no larger than OBJ_SIZE_MAX are served by per-size-class caches
+ * (16, 32, ..., 2048 bytes). Each cache carves its objects out of slabs,
+ * which are SLAB_SIZE chunks allocated from the kernel heap; so a small
+ * allocation is only a freelist pop, and the heap tree is touched only when
+ * a cache runs out of slabs.
+ *
+ * In front of the slabs, each CPU keeps magazines (small stacks of free
+ * objects) and exchanges whole magazines with a shared depot.
+ */
+namespace Slab
+{
+	static const int
+		OBJ_SHIFT_MIN = 4,
+		OBJ_SHIFT_MAX = 11,
+		NCLASS = OBJ_SHIFT_MAX - OBJ_SHIFT_MIN + 1,
+		SLAB_SHIFT = 14;
+
+	static const uint32_t
+		OBJ_SIZE_MAX = 1 << OBJ_SHIFT_MAX,
+		SLAB_SIZE = 1 << SLAB_SHIFT;
+
+	/*
+	 * allocate an object of @size bytes aligned on 2^@palign byte boundries
+	 * NULL is returned if the request is too large for the slab caches
+	 *
+	 * Note: must not be called before kheap_finish_init
+	 */
+	extern void* alloc(uint32_t size, int palign);
+
+	// free an object allocated by alloc()
+	// return false if @ptr does not belong to any slab
+	extern bool free(void *ptr);
+
+	// get the size of the object @ptr, or 0 if @ptr does not belong to any slab
+	extern uint32_t get_obj_size(const void *ptr);
+
+	struct Class_stat_t
+	{
+		uint32_t
+			size,	// object size of this class
+			nmag,	// number of allocations served by magazines
+			nhit,	// number of allocations served by existing slabs
+			nmiss,	// number of allocations that required a new slab
+			nslab,	// number of slabs currently owned
+			nobj;	// number of objects currently allocated
+	};
+
+	extern void get_class_stat(int cls, Class_stat_t &stat);
+
+#ifdef _DEBUG_BUILD_
+	extern void output_debug_msg();
+#endif
+}
+
+#endif // _HEADER_SLAB_
+
@@ -1,6 +1,6 @@
 /*
  * $File: task.h
- * $Date: Thu Dec 23 18:29:03 2010 +0800
+ * $Date: Sun Oct 18 10:07:11 2026 +0800
  *
  * task scheduling and managing
  */
@@ -29,25 +29,164 @@ along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
 #include <common.h>
 #include <signal.h>
 #include <types.h>
+#include <fs/base.h>
 
 namespace Task
 {
-	extern void init();
+	/*
+	 * initialize tasking, with @cmdline being the kernel command line
+	 * option "sched=fair" selects the fair scheduler instead of the
+	 * priority one
+	 */
+	extern void init(const char *cmdline);
 
-	// called by timer hook
+	// get the name of the scheduler in use
+	extern const char* get_sched_name();
+
+	// called by timer hook on every tick: account the time slice of current
+	// task, and switch to another task when the slice is used up
+	extern void tick();
+
+	// give up the CPU until the other runnable tasks have used their time slices
 	extern void schedule();
 
 
+	/*
+	 * the fork system call: create a copy of current user task, which
+	 * returns 0 from the system call
+	 * must only be called by isr0x80, since the child only gets a copy of the
+	 * syscall frame on top of the kernel stack
+	 * return the pid of the child, or -1 if no pid is available (EAGAIN)
+	 */
 	extern pid_t fork();
+
+	/*
+	 * the vfork system call: like fork(), but the child runs in the address
+	 * space of current task, which is suspended until the child calls exec()
+	 * or exits; nothing is copied or marked copy-on-write
+	 * the child must not return from the function that called vfork, since
+	 * it also shares the user stack
+	 * must only be called by isr0x80, like fork()
+	 * return the pid of the child, or -1 if no pid is available (EAGAIN)
+	 */
+	extern pid_t vfork();
+
+	/*
+	 * create a kernel task running @entry(@arg) on a fresh kernel stack, in a
+	 * copy-on-write copy of the current address space; the task exits with
+	 * status 0 when @entry returns
+	 * return the pid of the new task, or -1 if no pid is available (EAGAIN)
+	 */
+	extern pid_t kernel_thread(void (*entry)(void *arg), void *arg);
+
+	/*
+	 * create a task running the elf executable @file in a new address space,
+	 * with NULL-terminated argument list @argv
+	 * the executable is loaded by the new task itself, so nothing of the
+	 * current address space is copied
+	 * @file is deleted by the new task
+	 * return the pid of the new task, or -1 on error and errno is set accordingly
+	 */
+	extern pid_t spawn(Fs::Node_file *file, const char * const *argv);
+
+	/*
+	 * replace the address space of current task by a new one running the elf
+	 * executable @file, as if current task were spawned with @argv
+	 * a task created by vfork() gives back the address space of its parent
+	 * return -1 and set errno if the arguments are too long (E2BIG); otherwise
+	 * never return, and @file is deleted
+	 */
+	extern int exec(Fs::Node_file *file, const char * const *argv);
+
+	// address of the user stack page of spawned tasks
+	static const uint32_t SPAWN_STACK_PAGE = 0xC0000000;
 	extern pid_t getpid();
-	extern void exit(int status);
+
+	/*
+	 * terminate current task with exit status @status
+	 * the address space is freed at once; the task stays a zombie until its
+	 * parent reaps it by waitpid(), or until the idle task reaps it if the
+	 * parent has exited
+	 */
+	extern void exit(int status) __attribute__((noreturn));
+
+	/*
+	 * wait for child @pid (or any child if @pid is -1) to exit and reap it
+	 * return the pid of the child and store its exit status in @status,
+	 * or -1 on error and errno is set accordingly (ECHILD: no such child)
+	 */
+	extern pid_t waitpid(pid_t pid, int &status);
 
 	// suspend the execution of task with pid @pid
 	// the task will be automatically resumed on receiving any signal in @sig_wakeup
 	extern int sleep(pid_t pid, const Sigset &sig_wakeup);
 
+	/*
+	 * suspend current task for at most @nticks timer ticks, or until it is
+	 * woken up or receives any signal in @sig_wakeup
+	 * return the number of ticks left if resumed before the timeout, 0 otherwise
+	 */
+	extern uint32_t sleep_timeout(uint32_t nticks, const Sigset &sig_wakeup);
+
 	extern int wakeup(pid_t pid);
 
+	/*
+	 * A wait queue holds the tasks blocked on some object. Non-exclusive
+	 * waiters are all woken up by wake_up_one(), while exclusive ones are
+	 * woken up one at a time, so that a single event does not wake up a herd
+	 * of tasks that will find nothing to do. The entries live on the stacks
+	 * of the waiting tasks.
+	 */
+	struct Wait_queue_t;
+	struct Wait_entry_t
+	{
+		void *task;
+		bool exclusive;
+		Wait_queue_t *queue; // the queue containing this entry, NULL if not queued
+		Wait_entry_t *next, *prev;
+	};
+
+	struct Wait_queue_t
+	{
+		Wait_entry_t *head, *tail; // non-exclusive waiters come first
+
+		Wait_queue_t() : head(NULL), tail(NULL) {}
+	};
+
+	/*
+	 * block current task on @wq until woken up by the queue or wakeup()
+	 * must be called with interrupts disabled, which is also the state on return
+	 * use wait_event() unless you know what you are doing
+	 */
+	extern void wait(Wait_queue_t &wq, bool exclusive);
+
+	// like wait(), but for at most @nticks ticks
+	// return the number of ticks left if woken up before the timeout, 0 otherwise
+	extern uint32_t wait_timeout(Wait_queue_t &wq, bool exclusive, uint32_t nticks);
+
+	// wake up all non-exclusive waiters and the first exclusive one on @wq
+	extern void wake_up_one(Wait_queue_t &wq);
+
+	// wake up all waiters on @wq
+	extern void wake_up_all(Wait_queue_t &wq);
+
+	static const int NICE_MIN = -20, NICE_MAX = 19;
+
+	/*
+	 * set the nice value of task @pid to @nice, clamped to [NICE_MIN, NICE_MAX]
+	 * lower nice value means higher priority and longer time slices
+	 * decreasing the nice value requires CAP_SYS_NICE
+	 */
+	extern int set_nice(pid_t pid, int nice);
+
+	extern int get_nice(pid_t pid, int &nice);
+
+	// account @nbytes of kernel heap allocated (or freed, if @freed) by current task
+	extern void account_kmem(uint32_t nbytes, bool freed);
+
+	// get the number of bytes of kernel heap ever allocated and freed by task @pid
+	extern int get_kmem_stat(pid_t pid, uint32_t &nbytes_alloc, uint32_t &nbytes_free);
+
 
 	// whether the current task is kernel code or user program
 	extern bool is_kernel();
@@ -57,5 +196,45 @@ namespace Task
 	extern void switch_to_user_mode(uint32_t addr, uint32_t esp);
 }
 
+/*
+ * block current task on wait queue @_wq_ until @_cond_ holds
+ * @_cond_ is checked with interrupts disabled, so a wakeup between the
+ * check and blocking is not lost
+ */
+#define wait_event(_wq_, _cond_) \
+do \
+{ \
+	uint32_t _eflags_; \
+	CLI_SAVE_EFLAGS(_eflags_); \
+	while (!(_cond_)) \
+		Task::wait(_wq_, false); \
+	RESTORE_EFLAGS(_eflags_); \
+} while (0)
+
+// like wait_event(), but the waiter is exclusive
+#define wait_event_exclusive(_wq_, _cond_) \
+do \
+{ \
+	uint32_t _eflags_; \
+	CLI_SAVE_EFLAGS(_eflags_); \
+	while (!(_cond_)) \
+		Task::wait(_wq_, true); \
+	RESTORE_EFLAGS(_eflags_); \
+} while (0)
+
+// like wait_event(), but give up after @_nticks_ ticks
+// evaluate to 0 if @_cond_ still does not hold, or the number of ticks left (at least 1)
+#define wait_event_timeout(_wq_, _cond_, _nticks_) \
+({ \
+	uint32_t _eflags_, _left_ = (_nticks_); \
+	CLI_SAVE_EFLAGS(_eflags_); \
+	while (!(_cond_) && _left_) \
+		_left_ = Task::wait_timeout(_wq_, false, _left_); \
+	if (_cond_) \
+		_left_ = max(_left_, 1u); \
+	RESTORE_EFLAGS(_eflags_); \
+	_left_; \
+})
+
 #endif // _HEADER_TASK_
 
@@ -0,0 +1,124 @@
+/*
+ * $File: timer.h
+ * $Date: Sun Oct 18 09:52:57 2026 +0800
+ *
+ * the system timer (PIT channel 0)
+ */
+/*
+This file is part of JKOS
+
+Copyright (C) <2010>  Jiakai <jia.kai66@gmail.com>
+
+JKOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JKOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JKOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HEADER_TIMER_
+#define _HEADER_TIMER_
+
+#include <common.h>
+
+/*
+ * The PIT normally interrupts KERNEL_HZ times per second, and every
+ * interrupt is a tick. When the CPU goes idle, the periodic tick can be
+ * stopped and the PIT programmed to interrupt once, as late as possible;
+ * the ticks missed meanwhile are accounted when the tick is resumed.
+ *
+ * Timers are kept in a hierarchical timing wheel: a timer due within 256
+ * ticks is in one of the 256 slots of the first level, one for each tick;
+ * later ones are in the 64-slot higher levels, each slot covering 64 times
+ * as many ticks as one of the level below. Whenever the first level wraps
+ * around, a slot of the second level is emptied into the first, and so on.
+ * So adding and cancelling a timer are O(1).
+ */
+namespace Timer
+{
+	// program the PIT and register the timer interrupt handler
+	extern void init();
+
+	// get the number of ticks since the timer was initialized
+	extern uint32_t get_ticks();
+
+	/*
+	 * stop the periodic tick, and interrupt only once after @nticks ticks
+	 * the PIT can not count longer than MAX_ONESHOT_CYCLES (about 55ms), which
+	 * is used if @nticks is more than MAX_ONESHOT_TICKS
+	 * must be called with interrupts disabled
+	 */
+	extern void stop_tick(uint32_t nticks);
+
+	// resume the periodic tick if it has been stopped
+	// must be called with interrupts disabled
+	extern void resume_tick();
+
+	static const uint32_t
+		TICK_CYCLES = CLOCK_TICK_RATE / KERNEL_HZ, // PIT cycles per tick
+		MAX_ONESHOT_CYCLES = 0xFFFF,
+		MAX_ONESHOT_TICKS = MAX_ONESHOT_CYCLES / TICK_CYCLES,
+		NS_PER_TICK = 1000000000 / KERNEL_HZ;
+
+	struct Timer_t
+	{
+		typedef void (*Callback_t)(void *arg);
+
+		// called from the timer interrupt, with interrupts disabled;
+		// it must not switch tasks, since the timer may be on the stack of
+		// another task (the switch is left to Task::tick)
+		Callback_t callback;
+		void *arg;
+
+		uint32_t
+			expires,	// the tick at which the timer fires
+			period;		// if nonzero, fire again every @period ticks
+
+		// the wheel slot containing this timer, or NULL if it is not pending
+		Timer_t **slot;
+		Timer_t *next, *prev; // neighbours in the slot
+	};
+
+	// initialize @timer, which will not be pending
+	extern void setup(Timer_t &timer, Timer_t::Callback_t callback, void *arg);
+
+	// make @timer fire at tick @expires (or as soon as possible if it has
+	// passed); a pending timer is moved
+	extern void add(Timer_t &timer, uint32_t expires);
+
+	// cancel @timer, return whether it was pending
+	extern bool cancel(Timer_t &timer);
+
+	// get the number of ticks from now until a timer may fire, at most @limit
+	// must be called with interrupts disabled
+	extern uint32_t next_expiry(uint32_t limit);
+
+	// time interval used by the nanosleep syscall
+	struct Timespec_t
+	{
+		uint32_t sec, nsec;
+	};
+
+	// convert @ts to ticks, rounding up
+	static inline uint32_t timespec2ticks(const Timespec_t &ts)
+	{
+		uint32_t sec = min(ts.sec, (uint32_t)0x7FFFFFFF / KERNEL_HZ);
+		return sec * KERNEL_HZ + (ts.nsec + NS_PER_TICK - 1) / NS_PER_TICK;
+	}
+
+	static inline void ticks2timespec(uint32_t nticks, Timespec_t &ts)
+	{
+		ts.sec = nticks / KERNEL_HZ;
+		ts.nsec = nticks % KERNEL_HZ * NS_PER_TICK;
+	}
+}
+
+#endif // _HEADER_TIMER_
+
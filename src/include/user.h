@@ -1,6 +1,6 @@
 /*
  * $File: user.h
- * $Date: Thu Dec 23 16:21:04 2010 +0800
+ * $Date: Sun Oct 18 09:23:46 2026 +0800
  *
  * user and user permission management
  */
@@ -32,7 +32,8 @@ namespace User
 {
 	enum Cap_t
 	{
-		CAP_KILL
+		CAP_KILL,
+		CAP_SYS_NICE
 	};
 	int cap_test(uid_t uid, Cap_t cap);
 }
@@ -1,6 +1,6 @@
 /*
  * $File: cstring.cpp
- * $Date: Wed Dec 29 19:35:09 2010 +0800
+ * $Date: Sun Oct 18 09:17:35 2026 +0800
  *
  * functions for manipulating C-style strings
  */
@@ -61,3 +61,21 @@ char *strcpy(char *dest, const char *src)
 	return (char*)dest;
 }
 
+size_t strlen(const char *str)
+{
+	const char *end = str;
+	while (*end)
+		end ++;
+	return (size_t)(end - str);
+}
+
+int strcmp(const char *s1, const char *s2)
+{
+	while (*s1 && *s1 == *s2)
+	{
+		s1 ++;
+		s2 ++;
+	}
+	return (int)(uint8_t)*s1 - (int)(uint8_t)*s2;
+}
+
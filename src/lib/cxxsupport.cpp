@@ -1,6 +1,6 @@
 /*
  * $File: cxxsupport.cpp
- * $Date: Fri Dec 03 15:32:47 2010 +0800
+ * $Date: Sun Oct 18 09:02:03 2026 +0800
  *
  * C++ support functions
  *
@@ -118,12 +118,12 @@ void __cxa_pure_virtual()
 
 extern void *operator new(uint32_t size)
 {
-	return kmalloc(size);
+	return kmalloc_at(size, 0, __builtin_return_address(0));
 }
  
 extern void *operator new[](uint32_t size)
 {
-	return kmalloc(size);
+	return kmalloc_at(size, 0, __builtin_return_address(0));
 }
  
 extern void operator delete(void *p)